@@ -0,0 +1,132 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+// local producer for the IK target stream, to test UIKTargetStreamSubsystem without a mocap or simulation process.
+// every stream moves its target on a circle, in world space (cm), and the frames are published at a fixed rate.
+// it is not part of the Unreal build:
+//     c++ -std=c++17 -O2 -I../demo_ik IKTargetProducer.cpp -o ik_target_producer -lrt
+//     ./ik_target_producer [streams=64] [rate=120] [slots=8] [name=/demo_ik_targets]
+// then set targetStreamId on the IK components (stream i circles around (0, 100 * i, 120)).
+
+#include "IKTargetStreamProtocol.h"
+
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static volatile std::sig_atomic_t isRunning = 1;
+
+static void onSignal(int)
+{
+	isRunning = 0;
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t maxStreams = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 64;
+	const double rate = argc > 2 ? std::atof(argv[2]) : 120.0;
+	const uint32_t slotCount = argc > 3 ? static_cast<uint32_t>(std::atoi(argv[3])) : 8;
+	const char* name = argc > 4 ? argv[4] : IKTargetStream::DefaultName;
+	if (maxStreams == 0 || slotCount == 0 || rate <= 0.0)
+	{
+		std::fprintf(stderr, "usage: %s [streams] [rate] [slots] [name]\n", argv[0]);
+		return 1;
+	}
+
+	// create a new segment, the game maps it read-only. a segment left by a previous run is unlinked rather than
+	// truncated: a game that still maps it keeps the old pages, and reconnects once it notices the new generation.
+	const size_t size = IKTargetStream::segmentSize(slotCount, maxStreams);
+	shm_unlink(name);
+	const int fileDescriptor = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	struct stat segmentStat;
+	if (fileDescriptor < 0 || ftruncate(fileDescriptor, static_cast<off_t>(size)) != 0 || fstat(fileDescriptor, &segmentStat) != 0)
+	{
+		std::perror("shm_open");
+		return 1;
+	}
+	void* segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+	close(fileDescriptor);
+	if (segment == MAP_FAILED)
+	{
+		std::perror("mmap");
+		shm_unlink(name);
+		return 1;
+	}
+
+	// the header is complete before the magic is visible to a reader.
+	IKTargetStream::Header* header = new (segment) IKTargetStream::Header();
+	header->version = IKTargetStream::Version;
+	header->slotCount = slotCount;
+	header->maxStreams = maxStreams;
+	header->generation = static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()) ^ (static_cast<uint64_t>(getpid()) << 48);
+	if (header->generation == 0)
+	{
+		header->generation = 1;
+	}
+	header->publishedFrames.store(0, std::memory_order_relaxed);
+	header->isProducing.store(1, std::memory_order_relaxed);
+	for (uint32_t s = 0; s < slotCount; ++s)
+	{
+		new (IKTargetStream::slotOf(header, slotCount, maxStreams, s)) IKTargetStream::SlotHeader();
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = IKTargetStream::Magic;
+
+	std::signal(SIGINT, onSignal);
+	std::signal(SIGTERM, onSignal);
+	std::printf("publishing %u streams at %.0f Hz through %s (%u frames), ctrl-c to stop\n", maxStreams, rate, name, slotCount);
+
+	const auto period = std::chrono::duration<double>(1.0 / rate);
+	const auto start = std::chrono::steady_clock::now();
+	auto nextFrameTime = start;
+	for (uint64_t frame = 0; isRunning; ++frame)
+	{
+		const double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// seqlock write: mark the slot as being written, fill it, then mark it complete and publish it.
+		IKTargetStream::SlotHeader* slot = IKTargetStream::slotOf(header, slotCount, maxStreams, frame);
+		slot->sequence.store(IKTargetStream::completeSequence(frame) - 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		IKTargetStream::Target* targets = IKTargetStream::targetsOf(slot);
+		for (uint32_t i = 0; i < maxStreams; ++i)
+		{
+			const double angle = time * 2.0 + i * 0.1;
+			targets[i].x = static_cast<float>(50.0 * std::cos(angle));
+			targets[i].y = static_cast<float>(100.0 * i + 50.0 * std::sin(angle));
+			targets[i].z = static_cast<float>(120.0 + 20.0 * std::sin(angle * 0.5));
+			targets[i].valid = 1;
+		}
+
+		slot->sequence.store(IKTargetStream::completeSequence(frame), std::memory_order_release);
+		header->publishedFrames.store(frame + 1, std::memory_order_release);
+
+		nextFrameTime += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+		std::this_thread::sleep_until(nextFrameTime);
+	}
+
+	// tell the mapped readers to disconnect, then remove the segment, unless a newer run already replaced it.
+	header->isProducing.store(0, std::memory_order_release);
+	munmap(segment, size);
+	const int currentDescriptor = shm_open(name, O_RDONLY, 0);
+	if (currentDescriptor >= 0)
+	{
+		struct stat currentStat;
+		if (fstat(currentDescriptor, &currentStat) == 0 && currentStat.st_dev == segmentStat.st_dev && currentStat.st_ino == segmentStat.st_ino)
+		{
+			shm_unlink(name);
+		}
+		close(currentDescriptor);
+	}
+	return 0;
+}
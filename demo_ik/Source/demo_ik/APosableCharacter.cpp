@@ -1,6 +1,8 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "APosableCharacter.h"
+#include "PosableMeshStreaming.h"
+#include "Engine/GameInstance.h"
 
 // Sets default values
 AAPosableCharacter::AAPosableCharacter()
@@ -17,18 +19,14 @@ AAPosableCharacter::AAPosableCharacter()
 	posableMeshComponent_reference->SetupAttachment(RootComponent);
 	RootComponent = posableMeshComponent_reference;
 
-	// reference the mannequin asset by path (be aware to check the path if this is not working).
-	static ConstructorHelpers::FObjectFinder<USkeletalMesh> MannequinMesh(TEXT("/Game/Characters/Mannequins/Meshes/SKM_Manny_Simple"));
-	if (MannequinMesh.Succeeded())
-	{
-		// set default mesh with the mannequin access and apply it to the posable mesh.
-		default_skeletalMesh_reference = MannequinMesh.Object;
-	}
-	else
-	{
-		UE_LOG(LogTemp, Warning, TEXT("manequin not found, check the path."));
-	}
+	// default body proxies for the mannequin skeleton (pelvis, chest, head).
+	selfCollision_capsules.Emplace(FName("pelvis"), FName("spine_02"), 14.0f);
+	selfCollision_capsules.Emplace(FName("spine_03"), FName("spine_05"), 16.0f);
+	selfCollision_capsules.Emplace(FName("neck_01"), FName("head"), 11.0f);
 
+	// reference the mannequin asset by path, it is only loaded on BeginPlay (be aware to check the path if this is not working).
+	default_skeletalMesh_reference = TSoftObjectPtr<USkeletalMesh>(
+			FSoftObjectPath(TEXT("/Game/Characters/Mannequins/Meshes/SKM_Manny_Simple.SKM_Manny_Simple")));
 }
 
 bool AAPosableCharacter::initializePosableMesh()
@@ -39,17 +37,64 @@ bool AAPosableCharacter::initializePosableMesh()
 		UE_LOG(LogTemp, Warning, TEXT("Posable mesh component not attached or registerd"));
 		return false;
 	}
-	if (!default_skeletalMesh_reference)
+	USkeletalMesh* skeletalMesh = default_skeletalMesh_reference.Get();
+	if (!skeletalMesh)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("No skeletal mesh reference provided."));
+		UE_LOG(LogTemp, Warning, TEXT("No skeletal mesh reference provided or not loaded yet."));
 		return false;
 	}
 
 	// set up the poseable mesh component.
-	posableMeshComponent_reference->SetSkinnedAssetAndUpdate(default_skeletalMesh_reference);
+	posableMeshComponent_reference->SetSkinnedAssetAndUpdate(skeletalMesh);
 	return true;
 }
 
+void AAPosableCharacter::requestPosableMeshLoad()
+{
+	if (default_skeletalMesh_reference.IsNull())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("could not set default sk mesh ref"));
+		return;
+	}
+	// already resident (e.g. referenced by the level), no need to stream it.
+	if (default_skeletalMesh_reference.Get())
+	{
+		onPosableMeshLoaded();
+		return;
+	}
+
+	// the load is shared by the characters of the game instance, which keeps the mesh resident until it shuts down.
+	const UGameInstance* gameInstance = GetGameInstance();
+	UPosableMeshStreamingSubsystem* meshStreaming = gameInstance ? gameInstance->GetSubsystem<UPosableMeshStreamingSubsystem>() : nullptr;
+	if (!meshStreaming)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("no game instance to stream the skeletal mesh in"));
+		return;
+	}
+	if (!meshStreaming->requestMesh(this))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("manequin not found, check the path: %s"), *default_skeletalMesh_reference.ToString());
+	}
+}
+
+void AAPosableCharacter::onPosableMeshLoaded()
+{
+	if (posableMesh_isReady || !initializePosableMesh())
+	{
+		return;
+	}
+
+	// waving_initializeStartingPose();
+	initialBoneSpaceTransforms = posableMeshComponent_reference->BoneSpaceTransforms;
+
+	proceduralMotion_initializeDefaultLayers();
+	if (UProceduralMotionSubsystem* proceduralMotion = GetWorld()->GetSubsystem<UProceduralMotionSubsystem>())
+	{
+		proceduralMotion->registerCharacter(this);
+	}
+	posableMesh_isReady = true;
+}
+
 void AAPosableCharacter::waving_playStop()
 {
 	session1_isPlaying = !session1_isPlaying;
@@ -81,28 +126,6 @@ void AAPosableCharacter::setVisibility(bool visible)
 		posableMeshComponent_reference->SetVisibility(visible);
 }
 
-void AAPosableCharacter::storeCurrentPoseRotations(TArray<FRotator> &storedPose)
-{
-	// initialization check to avoid crashes.
-	if (!posableMeshComponent_reference)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("Posable mesh component not attached or registerd"));
-		return;
-	}
-
-	const int32 NumBones = posableMeshComponent_reference->GetNumBones();
-	storedPose.SetNum(NumBones);
-
-	for (int32 BoneIndex = 0; BoneIndex < NumBones; ++BoneIndex)
-	{
-		FName BoneName = posableMeshComponent_reference->GetBoneName(BoneIndex);
-		if (BoneName != NAME_None)
-		{
-			storedPose[BoneIndex] = posableMeshComponent_reference->GetBoneRotationByName(BoneName, EBoneSpaces::ComponentSpace);
-		}
-	}
-}
-
 void AAPosableCharacter::waving_initializeStartingPose()
 {
 	// initialization check to avoid crashes.
@@ -154,173 +177,149 @@ void AAPosableCharacter::waving_initializeStartingPose()
 	}
 }
 
-void AAPosableCharacter::waving_tickAnimation()
+void AAPosableCharacter::proceduralMotion_initializeDefaultLayers()
 {
-	// initialization check to avoid crashes.
-	if (!posableMeshComponent_reference)
+	if (proceduralMotion_layers.Num() == 0)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Posable mesh component not attached or registerd"));
-		return;
+		// waving: oscillate the lower arm yaw around its initial rotation.
+		FProceduralMotionLayer& wavingLayer = proceduralMotion_layers.AddDefaulted_GetRef();
+		wavingLayer.layerName = FName("waving");
+		FProceduralMotionEntry& lowerarmWave = wavingLayer.entries.AddDefaulted_GetRef();
+		lowerarmWave.boneName = FName("lowerarm_r");
+		lowerarmWave.generator = EProceduralMotionGenerator::Oscillator;
+		lowerarmWave.axis = FRotator(0.0f, 1.0f, 0.0f);
+
+		// hand-to-heart: tween the arm between its initial rotation and the hand on the chest.
+		FProceduralMotionLayer& handToHeartLayer = proceduralMotion_layers.AddDefaulted_GetRef();
+		handToHeartLayer.layerName = FName("handToHeart");
+		FProceduralMotionEntry& lowerarmTween = handToHeartLayer.entries.AddDefaulted_GetRef();
+		lowerarmTween.boneName = FName("lowerarm_r");
+		lowerarmTween.generator = EProceduralMotionGenerator::SlerpTween;
+		lowerarmTween.targetRotation = FRotator(-39.999999, 128.978820f, -109.999997f);
+		FProceduralMotionEntry& upperarmTween = handToHeartLayer.entries.AddDefaulted_GetRef();
+		upperarmTween.boneName = FName("upperarm_r");
+		upperarmTween.generator = EProceduralMotionGenerator::SlerpTween;
+		upperarmTween.targetRotation = FRotator(-11.350484, 77.239075, -45.080829);
+
+		proceduralMotion_hasDefaultLayers = true;
 	}
-	const float currentTime = GetWorld()->GetTimeSeconds();
-	const int32 numBones = posableMeshComponent_reference->GetNumBones();
-	if (initialBoneRotations.Num() != numBones)
+
+	proceduralMotion_findDefaultLayers();
+	proceduralMotion_updateDefaultLayers();
+}
+
+void AAPosableCharacter::proceduralMotion_findDefaultLayers()
+{
+	waving_layerIndex = proceduralMotion_layers.IndexOfByPredicate(
+			[](const FProceduralMotionLayer& layer) { return layer.layerName == FName("waving"); });
+	handToHeart_layerIndex = proceduralMotion_layers.IndexOfByPredicate(
+			[](const FProceduralMotionLayer& layer) { return layer.layerName == FName("handToHeart"); });
+}
+
+void AAPosableCharacter::proceduralMotion_updateDefaultLayers()
+{
+	// layers set by the user keep their own parameters.
+	if (!proceduralMotion_hasDefaultLayers)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("You need to call session1_initialBoneRotations first!"));
 		return;
 	}
 
-	FName lowerarmBoneName = FName("lowerarm_r");
-
-	if (doesBoneOrSocketNameExists(lowerarmBoneName))
+	if (proceduralMotion_layers.IsValidIndex(waving_layerIndex))
 	{
-		FTransform bone_componentSpaceTransform = posableMeshComponent_reference->GetBoneTransformByName(
-				lowerarmBoneName,
-				EBoneSpaces::ComponentSpace);
-		int currentBoneIndex = posableMeshComponent_reference->GetBoneIndex(lowerarmBoneName);
-		FRotator storedRotation = initialBoneRotations[currentBoneIndex];
-		bone_componentSpaceTransform.SetRotation(storedRotation.Quaternion());
-
-		FTransform parent_componentSpaceTransform = posableMeshComponent_reference->GetBoneTransformByName(
-				posableMeshComponent_reference->GetParentBone(lowerarmBoneName),
-				EBoneSpaces::ComponentSpace);
-		FTransform bone_relativeTransform = bone_componentSpaceTransform.GetRelativeTransform(parent_componentSpaceTransform);
-
-		// calculate the rotation offset angle using a sine wave function
-		float angleOffset = FMath::Sin(waving_animationSpeed * currentTime) * waving_amplitude; // 30 degrees amplitude
-		FRotator rotationOffset(0.0f, angleOffset, 0.0f);
-
-		// apply the offset to the initial rotation
-		FRotator relativeBoneRotation = bone_relativeTransform.Rotator() + rotationOffset;
-
-		bone_relativeTransform.SetRotation(relativeBoneRotation.Quaternion());
-
-		FTransform newBoneTransform_world = bone_relativeTransform * parent_componentSpaceTransform;
-		posableMeshComponent_reference->SetBoneRotationByName(
-				lowerarmBoneName,
-				newBoneTransform_world.Rotator(),
-				EBoneSpaces::ComponentSpace);
+		for (FProceduralMotionEntry& entry : proceduralMotion_layers[waving_layerIndex].entries)
+		{
+			entry.speed = waving_animationSpeed;
+			entry.amplitude = waving_amplitude;
+		}
 	}
-	else
+	if (proceduralMotion_layers.IsValidIndex(handToHeart_layerIndex))
 	{
-		UE_LOG(LogTemp, Warning, TEXT("bone: %s not found!"), *lowerarmBoneName.ToString());
+		for (FProceduralMotionEntry& entry : proceduralMotion_layers[handToHeart_layerIndex].entries)
+		{
+			entry.speed = handToHeart_animationSpeed;
+		}
 	}
-
-
 }
 
-void AAPosableCharacter::handToHeart_tickAnimation()
+void AAPosableCharacter::proceduralMotion_updatePoseKey()
 {
-	// initialization check to avoid crashes.
-	if (!posableMeshComponent_reference)
+	proceduralMotion_poseKey = proceduralMotion_staticPoseKey;
+	if (proceduralMotion_staticPoseKey.bytes.Num() == 0)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Posable mesh component not attached or registerd"));
+		// the layers are not resolved (yet), the pose is not shared.
+		proceduralMotion_poseKey.appendValue(this);
 		return;
 	}
-	const float currentTime = GetWorld()->GetTimeSeconds();
-	const int32 numBones = posableMeshComponent_reference->GetNumBones();
-	if (initialBoneRotations.Num() != numBones)
+
+	proceduralMotion_poseKey.appendValue(proceduralMotion_layers.Num());
+	for (const FProceduralMotionLayer& layer : proceduralMotion_layers)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("You need to call the initialisation function first!"));
-		return;
+		proceduralMotion_poseKey.appendValue(layer.isPlaying);
 	}
+}
 
-	FName lowerarmBoneName = FName("lowerarm_r");
-	FName upperarmBoneName = FName("upperarm_r");
-
-	if (doesBoneOrSocketNameExists(lowerarmBoneName))
-	{
-		FTransform bone_componentSpaceTransform = posableMeshComponent_reference->GetBoneTransformByName(
-				lowerarmBoneName,
-				EBoneSpaces::ComponentSpace);
-		int currentBoneIndex = posableMeshComponent_reference->GetBoneIndex(lowerarmBoneName);
-		FRotator storedRotation = initialBoneRotations[currentBoneIndex];
-		bone_componentSpaceTransform.SetRotation(storedRotation.Quaternion());
+// Called when the game starts or when spawned
+void AAPosableCharacter::BeginPlay()
+{
+	Super::BeginPlay();
 
-		FTransform parent_componentSpaceTransform = posableMeshComponent_reference->GetBoneTransformByName(
-				posableMeshComponent_reference->GetParentBone(lowerarmBoneName),
-				EBoneSpaces::ComponentSpace);
-		FTransform bone_relativeTransform = bone_componentSpaceTransform.GetRelativeTransform(parent_componentSpaceTransform);
+	// the pose and procedural motion are set up once the mesh is resident.
+	requestPosableMeshLoad();
+}
 
-		float progress = 0.5f * FMath::Sin(handToHeart_animationSpeed * currentTime) + 0.5f;
-		
-		// apply the offset to the initial rotation
-		FRotator relativeBoneRotation = bone_relativeTransform.Rotator();
+void AAPosableCharacter::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (UProceduralMotionSubsystem* proceduralMotion = GetWorld()->GetSubsystem<UProceduralMotionSubsystem>())
+	{
+		proceduralMotion->unregisterCharacter(this);
+	}
+	Super::EndPlay(EndPlayReason);
+}
 
-		FQuat startRotation = bone_relativeTransform.GetRotation();
-		FQuat targetRotation = FRotator(-39.999999, 128.978820f, -109.999997f).Quaternion();
-		FQuat currentRotation = FQuat::Slerp(startRotation, targetRotation, progress);
-		bone_relativeTransform.SetRotation(currentRotation);
+#if WITH_EDITOR
+void AAPosableCharacter::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
 
-		FTransform newBoneTransform_world = bone_relativeTransform * parent_componentSpaceTransform;
-		posableMeshComponent_reference->SetBoneRotationByName(
-				lowerarmBoneName,
-				newBoneTransform_world.Rotator(),
-				EBoneSpaces::ComponentSpace);
-	}
-	else
+	// the subsystem evaluates a resolved copy of the layers, it has to resolve them again to see the edit.
+	const FName propertyName = PropertyChangedEvent.GetMemberPropertyName();
+	if (propertyName == GET_MEMBER_NAME_CHECKED(AAPosableCharacter, waving_animationSpeed)
+		|| propertyName == GET_MEMBER_NAME_CHECKED(AAPosableCharacter, waving_amplitude)
+		|| propertyName == GET_MEMBER_NAME_CHECKED(AAPosableCharacter, handToHeart_animationSpeed))
 	{
-		UE_LOG(LogTemp, Warning, TEXT("bone: %s not found!"), *lowerarmBoneName.ToString());
+		proceduralMotion_updateDefaultLayers();
 	}
-
-	if (doesBoneOrSocketNameExists(upperarmBoneName))
+	else if (propertyName == GET_MEMBER_NAME_CHECKED(AAPosableCharacter, proceduralMotion_layers))
 	{
-		FTransform bone_componentSpaceTransform = posableMeshComponent_reference->GetBoneTransformByName(
-			upperarmBoneName,
-			EBoneSpaces::ComponentSpace);
-		int currentBoneIndex = posableMeshComponent_reference->GetBoneIndex(upperarmBoneName);
-		FRotator storedRotation = initialBoneRotations[currentBoneIndex];
-		bone_componentSpaceTransform.SetRotation(storedRotation.Quaternion());
-
-		FTransform parent_componentSpaceTransform = posableMeshComponent_reference->GetBoneTransformByName(
-			posableMeshComponent_reference->GetParentBone(upperarmBoneName),
-			EBoneSpaces::ComponentSpace);
-		FTransform bone_relativeTransform = bone_componentSpaceTransform.GetRelativeTransform(parent_componentSpaceTransform);
-
-		float progress = 0.5f * FMath::Sin(handToHeart_animationSpeed * currentTime) + 0.5f;
-
-		// apply the offset to the initial rotation
-		FRotator relativeBoneRotation = bone_relativeTransform.Rotator();
-
-		FQuat startRotation = bone_relativeTransform.GetRotation();
-		FQuat targetRotation = FRotator(-11.350484, 77.239075, -45.080829).Quaternion();
-		FQuat currentRotation = FQuat::Slerp(startRotation, targetRotation, progress);
-		bone_relativeTransform.SetRotation(currentRotation);
-
-		FTransform newBoneTransform_world = bone_relativeTransform * parent_componentSpaceTransform;
-		posableMeshComponent_reference->SetBoneRotationByName(
-			upperarmBoneName,
-			newBoneTransform_world.Rotator(),
-			EBoneSpaces::ComponentSpace);
+		// the layers may have been added, removed or renamed.
+		proceduralMotion_findDefaultLayers();
 	}
 	else
 	{
-		UE_LOG(LogTemp, Warning, TEXT("bone: %s not found!"), *lowerarmBoneName.ToString());
+		return;
 	}
-}
 
-// Called when the game starts or when spawned
-void AAPosableCharacter::BeginPlay()
-{
-	Super::BeginPlay();
-	initializePosableMesh();
-	if (default_skeletalMesh_reference) {
-		posableMeshComponent_reference->SetSkinnedAssetAndUpdate(default_skeletalMesh_reference);
-	}
-	else {
-		UE_LOG(LogTemp, Warning, TEXT("could not set default sk mesh ref"));
+	UWorld* world = GetWorld();
+	UProceduralMotionSubsystem* proceduralMotion = world ? world->GetSubsystem<UProceduralMotionSubsystem>() : nullptr;
+	if (posableMesh_isReady && proceduralMotion)
+	{
+		proceduralMotion->markEntriesDirty();
 	}
-	// waving_initializeStartingPose();
-	initialBoneRotations = TArray<FRotator>();
-	storeCurrentPoseRotations(initialBoneRotations);
 }
+#endif
 
 // Called every frame
 void AAPosableCharacter::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
-	if (session1_isPlaying)
-		waving_tickAnimation();
-	if (handToHeart_isPlaying)
-		handToHeart_tickAnimation();
+
+	// the layers themselves are evaluated by the procedural motion subsystem.
+	if (proceduralMotion_layers.IsValidIndex(waving_layerIndex))
+		proceduralMotion_layers[waving_layerIndex].isPlaying = session1_isPlaying;
+	if (proceduralMotion_layers.IsValidIndex(handToHeart_layerIndex))
+		proceduralMotion_layers[handToHeart_layerIndex].isPlaying = handToHeart_isPlaying;
+
+	// the IK components key their shared solves on the procedural pose of this frame.
+	if (UPoseSharingSubsystem::isEnabled())
+		proceduralMotion_updatePoseKey();
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
 #include "Components/PoseableMeshComponent.h" 
+#include "ProceduralMotion.h"
+#include "IKSelfCollision.h"
 #include "APosableCharacter.generated.h"
 
 
@@ -26,10 +28,10 @@ public:
 	UPROPERTY(VisibleDefaultsOnly, Category = Mesh)
 	class UPoseableMeshComponent* posableMeshComponent_reference;
 	/**
-	* the default skeletal mesh component.
+	* the default skeletal mesh, streamed in asynchronously on BeginPlay.
 	**/
 	UPROPERTY(EditAnywhere, Category = Mesh) 
-	USkeletalMesh* default_skeletalMesh_reference;
+	TSoftObjectPtr<USkeletalMesh> default_skeletalMesh_reference;
 	/**
 	* the waving animation speed.
 	**/
@@ -50,12 +52,54 @@ public:
 	UPROPERTY(EditAnywhere, Category = "waving animation")
 	float waving_amplitude = 30.0f;
 
+	/**
+	* the procedural motion layers evaluated by the procedural motion subsystem.
+	* when left empty, the waving and hand-to-heart layers are created on BeginPlay.
+	**/
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	TArray<FProceduralMotionLayer> proceduralMotion_layers;
+
+	/**
+	* the capsule proxies of the body, used by the IK solvers to keep the chains out of the torso and head.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK self-collision")
+	TArray<FIKCapsuleProxy> selfCollision_capsules;
+
+	/**
+	* the pose sharing key of the resolved layers (skeleton and entries).
+	* set by the procedural motion subsystem when it resolves the layers, empty until then.
+	**/
+	FPoseSharingKey proceduralMotion_staticPoseKey;
+
+	/**
+	* the pose sharing key of the procedural pose (skeleton, layers and playing state).
+	* built on every tick while pose sharing is enabled, before the IK components of the character tick.
+	**/
+	FPoseSharingKey proceduralMotion_poseKey;
+
 
 protected:
 	/**
-	* the set of initial bone rotations for the waving animation, after setting the starting pose.
+	* the set of initial bone space (parent relative) transforms, after setting the starting pose.
+	* it is the base pose of the procedural motion layers.
 	**/
-	TArray<FRotator> initialBoneRotations;
+	TArray<FTransform> initialBoneSpaceTransforms;
+
+	/**
+	* the index of the waving and hand-to-heart layers in proceduralMotion_layers (INDEX_NONE if absent).
+	**/
+	int32 waving_layerIndex = INDEX_NONE;
+	int32 handToHeart_layerIndex = INDEX_NONE;
+
+	/**
+	* true if the waving and hand-to-heart layers were created from the animation properties (not set by the user).
+	**/
+	bool proceduralMotion_hasDefaultLayers = false;
+
+	/**
+	* true once the skeletal mesh is resident and the pose and procedural motion are set up.
+	**/
+	bool posableMesh_isReady = false;
 
 
 public:	
@@ -70,6 +114,17 @@ public:
 	**/
 	bool initializePosableMesh();
 
+	/**
+	* @return: true once the skeletal mesh is loaded and the pose is set up.
+	**/
+	bool isPosableMeshReady() const { return posableMesh_isReady; }
+
+	/**
+	* set up the mesh, the initial pose and the procedural motion once the skeletal mesh is resident.
+	* called by the mesh streaming subsystem when the requested mesh is loaded.
+	**/
+	void onPosableMeshLoaded();
+
 	/**
 	* function to play or stop the waving animation.
 	* UPROPERTY is used to allow the function to be called from the editor.
@@ -91,23 +146,43 @@ public:
 	**/
 	void setVisibility(bool visible);
 
-
-protected:
 	/**
-	* the initial bone rotations for the waving animation.
+	* @return: the initial bone space transforms (empty until the mesh is initialized).
 	**/
-	void storeCurrentPoseRotations(TArray<FRotator>& storedPose);
+	const TArray<FTransform>& getInitialBoneSpaceTransforms() const { return initialBoneSpaceTransforms; }
+
+
+protected:
 	/**
 	* waving animation initialization (used ib BeginPlay).
 	**/
 	void waving_initializeStartingPose();
 
 	/**
-	* waving animation tick (used in Tick).
+	* request the default skeletal mesh from the mesh streaming subsystem. the load is shared by all the characters using
+	* the same mesh, and onPosableMeshLoaded is called once it is resident (immediately if it already is).
+	**/
+	void requestPosableMeshLoad();
+
+	/**
+	* create the waving and hand-to-heart layers from the animation properties, if no layers were set.
 	**/
-	void waving_tickAnimation();
+	void proceduralMotion_initializeDefaultLayers();
 
-	void handToHeart_tickAnimation();
+	/**
+	* find the index of the waving and hand-to-heart layers by name.
+	**/
+	void proceduralMotion_findDefaultLayers();
+
+	/**
+	* copy the waving and hand-to-heart animation properties (speed, amplitude) into the default layers.
+	**/
+	void proceduralMotion_updateDefaultLayers();
+
+	/**
+	* build the procedural pose key of the frame from the static key and the playing state of the layers.
+	**/
+	void proceduralMotion_updatePoseKey();
 
 
 
@@ -115,8 +190,16 @@ protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 
+	// Called when the actor is removed from the world
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:	
 	// Called every frame
 	virtual void Tick(float DeltaTime) override;
 
+#if WITH_EDITOR
+	// Called when a property is edited, also on the playing instance
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
 };
@@ -0,0 +1,303 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "IKAutoTuneCommandlet.h"
+#include "IK_CCD.h"
+#include "Components/PoseableMeshComponent.h"
+#include "Engine/SkeletalMesh.h"
+#include "Engine/World.h"
+#include "Math/RandomStream.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "UObject/Package.h"
+
+
+namespace
+{
+	TArray<float> parseFloatList(const FString& list)
+	{
+		TArray<FString> items;
+		list.ParseIntoArray(items, TEXT(","));
+		TArray<float> values;
+		for (const FString& item : items)
+		{
+			values.Add(FCString::Atof(*item));
+		}
+		return values;
+	}
+}
+
+
+UIKAutoTuneCommandlet::UIKAutoTuneCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UIKAutoTuneCommandlet::Main(const FString& Params)
+{
+	FString meshPath = TEXT("/Game/Characters/Mannequins/Meshes/SKM_Manny_Simple.SKM_Manny_Simple");
+	FString chainsParam = TEXT("hand_l.lowerarm_l.upperarm_l;hand_r.lowerarm_r.upperarm_r");
+	FString thresholdsParam = TEXT("0.01,0.1,0.5,1");
+	FString iterationsParam = TEXT("1,2,4,6,8,10,16,32");
+	int32 sampleCount = 256;
+	int32 seed = 1;
+	float maxError = 0.5f;
+	// the lists contain separators, so the string values are not cut at the first one.
+	FParse::Value(*Params, TEXT("Mesh="), meshPath, false);
+	FParse::Value(*Params, TEXT("Chains="), chainsParam, false);
+	FParse::Value(*Params, TEXT("Thresholds="), thresholdsParam, false);
+	FParse::Value(*Params, TEXT("Iterations="), iterationsParam, false);
+	FParse::Value(*Params, TEXT("Samples="), sampleCount);
+	FParse::Value(*Params, TEXT("Seed="), seed);
+	FParse::Value(*Params, TEXT("MaxError="), maxError);
+	const bool shouldWrite = !FParse::Param(*Params, TEXT("NoWrite"));
+	const TArray<float> thresholds = parseFloatList(thresholdsParam);
+	const TArray<float> iterationCounts = parseFloatList(iterationsParam);
+
+	USkeletalMesh* skeletalMesh = LoadObject<USkeletalMesh>(nullptr, *meshPath);
+	if (!skeletalMesh)
+	{
+		UE_LOG(LogTemp, Error, TEXT("IK auto-tune: skeletal mesh %s not found, check the path."), *meshPath);
+		return 1;
+	}
+
+	// a transient world to register the posable mesh in, so its bone transforms are computed.
+	UWorld* world = UWorld::CreateWorld(EWorldType::Game, false);
+	UPoseableMeshComponent* skeleton = NewObject<UPoseableMeshComponent>(GetTransientPackage());
+	skeleton->RegisterComponentWithWorld(world);
+	skeleton->SetSkinnedAssetAndUpdate(skeletalMesh);
+	const TArray<FTransform> restPose = skeleton->BoneSpaceTransforms;
+	UIK_CCD* solver = NewObject<UIK_CCD>(GetTransientPackage());
+
+	TArray<FString> chains;
+	chainsParam.ParseIntoArray(chains, TEXT(";"));
+	TMap<FString, FString> tunedSettings;
+
+	for (const FString& chainParam : chains)
+	{
+		TArray<FString> chain;
+		chainParam.ParseIntoArray(chain, TEXT("."));
+		if (chain.ContainsByPredicate([skeleton](const FString& boneName) { return skeleton->GetBoneIndex(FName(boneName)) == INDEX_NONE; }))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("IK auto-tune: chain %s has bones missing from %s, skipped"), *chainParam, *skeletalMesh->GetName());
+			continue;
+		}
+
+		const FString chainKey = UIK_CCD::getChainKey(skeletalMesh, chain);
+		const float reachRadius = solver->getReachData(skeleton, chain).totalLength;
+		bool isRecorded = false;
+		TArray<int32> sessionStarts;
+		const TArray<FVector> workload = loadWorkload(chainKey, reachRadius, sampleCount, seed, isRecorded, sessionStarts);
+
+		// the only solver in this module is CCD, the sweep covers its threshold and iteration budget.
+		TArray<FTuneCandidate> candidates;
+		for (float threshold : thresholds)
+		{
+			for (float iterationCount : iterationCounts)
+			{
+				candidates.Add(measure(solver, skeleton, chain, workload, isRecorded, sessionStarts, restPose, reachRadius, threshold, FMath::RoundToInt(iterationCount)));
+			}
+		}
+
+		const TArray<FTuneCandidate> front = paretoFront(candidates);
+		UE_LOG(LogTemp, Display, TEXT("IK auto-tune: %s, %d targets, Pareto front:"), *chainKey, workload.Num());
+		for (const FTuneCandidate& candidate : front)
+		{
+			UE_LOG(LogTemp, Display, TEXT("    threshold %.3f, %2d iterations: %.2f us/solve, mean error %.3f, max error %.3f"),
+					candidate.threshold, candidate.iterationCount, candidate.microsecondsPerSolve, candidate.meanError, candidate.maxError);
+		}
+
+		// the fastest setting within the error budget, the most accurate one if none is.
+		const FTuneCandidate* chosen = front.FindByPredicate([maxError](const FTuneCandidate& candidate) { return candidate.meanError <= maxError; });
+		if (!chosen && front.Num() > 0)
+		{
+			chosen = &front.Last();
+		}
+		if (chosen)
+		{
+			UE_LOG(LogTemp, Display, TEXT("IK auto-tune: %s -> threshold %.3f, %d iterations"), *chainKey, chosen->threshold, chosen->iterationCount);
+			tunedSettings.Add(chainKey, FString::Printf(TEXT("(threshold=%g,iterationCount=%d)"), chosen->threshold, chosen->iterationCount));
+		}
+	}
+
+	skeleton->UnregisterComponent();
+	world->DestroyWorld(false);
+
+	if (shouldWrite && tunedSettings.Num() > 0 && !writeTunedSettings(tunedSettings))
+	{
+		UE_LOG(LogTemp, Error, TEXT("IK auto-tune: could not write the tuned settings."));
+		return 1;
+	}
+	return 0;
+}
+
+TArray<FVector> UIKAutoTuneCommandlet::loadWorkload(const FString& chainKey, float reachRadius, int32 sampleCount, int32 seed, bool& outIsRecorded,
+		TArray<int32>& outSessionStarts) const
+{
+	TArray<FVector> workload;
+	outIsRecorded = false;
+	outSessionStarts.Reset();
+
+	// recorded in game by UIK_CCD::autoTune_recordTargets, one x,y,z target per line, each play session after a separator line.
+	const FString workloadPath = FPaths::ProjectSavedDir() / TEXT("IKAutoTune") / chainKey + TEXT(".csv");
+	TArray<FString> lines;
+	if (FFileHelper::LoadFileToStringArray(lines, *workloadPath))
+	{
+		// consecutive frames, in order: the solves are warm-started like in game, which relies on the frame to frame coherence.
+		for (int32 l = 0; l < lines.Num() && workload.Num() < sampleCount; ++l)
+		{
+			// the frames of two sessions are unrelated: the replay restarts from the rest pose there.
+			if (lines[l].TrimStartAndEnd() == UIK_CCD::autoTuneSessionSeparator)
+			{
+				if (workload.Num() > 0 && (outSessionStarts.Num() == 0 || outSessionStarts.Last() != workload.Num()))
+				{
+					outSessionStarts.Add(workload.Num());
+				}
+				continue;
+			}
+			TArray<FString> coordinates;
+			if (lines[l].ParseIntoArray(coordinates, TEXT(",")) == 3)
+			{
+				workload.Emplace(FCString::Atof(*coordinates[0]), FCString::Atof(*coordinates[1]), FCString::Atof(*coordinates[2]));
+			}
+		}
+		UE_LOG(LogTemp, Display, TEXT("IK auto-tune: %s, replaying %d recorded targets in %d sessions from %s"),
+				*chainKey, workload.Num(), outSessionStarts.Num() + 1, *workloadPath);
+		outIsRecorded = workload.Num() > 0;
+	}
+
+	// synthetic: uniform in the reach sphere of the chain.
+	if (workload.Num() == 0)
+	{
+		FRandomStream random(seed);
+		for (int32 i = 0; i < sampleCount; ++i)
+		{
+			workload.Add(random.VRand() * reachRadius * FMath::Pow(random.FRand(), 1.0f / 3.0f));
+		}
+	}
+	return workload;
+}
+
+UIKAutoTuneCommandlet::FTuneCandidate UIKAutoTuneCommandlet::measure(UIK_CCD* solver, UPoseableMeshComponent* skeleton, TArray<FString>& chain,
+		const TArray<FVector>& workload, bool warmStart, const TArray<int32>& sessionStarts, const TArray<FTransform>& restPose, float reachRadius,
+		float threshold, int32 iterationCount) const
+{
+	FTuneCandidate candidate;
+	candidate.threshold = threshold;
+	candidate.iterationCount = iterationCount;
+
+	// every setting replays the workload from the same rest pose, so all the settings see the same problems.
+	skeleton->BoneSpaceTransforms = restPose;
+	skeleton->RefreshBoneTransforms();
+
+	uint64 solveCycles = 0;
+	for (int32 w = 0; w < workload.Num(); ++w)
+	{
+		const FVector& rootRelativeTarget = workload[w];
+
+		// a recorded target starts from the previous solve, as the game does from the previous frame, unless it starts a session.
+		// the synthetic targets are unrelated to each other, each one starts from the rest pose.
+		if (!warmStart || sessionStarts.Contains(w))
+		{
+			skeleton->BoneSpaceTransforms = restPose;
+			skeleton->RefreshBoneTransforms();
+		}
+		const FVector root_componentSpace = skeleton->GetBoneLocationByName(FName(chain.Last()), EBoneSpaces::ComponentSpace);
+		const FVector targetPosition = skeleton->GetComponentTransform().TransformPosition(root_componentSpace + rootRelativeTarget);
+
+		const uint64 startCycles = FPlatformTime::Cycles64();
+		solver->Solve(skeleton, targetPosition, chain, threshold, iterationCount);
+		solveCycles += FPlatformTime::Cycles64() - startCycles;
+
+		// measured on the refreshed pose (untimed, the game refreshes once per frame whatever the solver does),
+		// in component space like the target and the reach radius.
+		skeleton->RefreshBoneTransforms();
+		const FVector endEffector_componentSpace = skeleton->GetBoneLocationByName(FName(chain[0]), EBoneSpaces::ComponentSpace);
+		const double solveError = FVector::Dist(endEffector_componentSpace, root_componentSpace + rootRelativeTarget);
+
+		// the part of the error due to an unreachable target is not the solver's.
+		const double error = FMath::Max(0.0, solveError - FMath::Max(0.0, rootRelativeTarget.Size() - reachRadius));
+		candidate.meanError += error;
+		candidate.maxError = FMath::Max(candidate.maxError, error);
+	}
+
+	if (workload.Num() > 0)
+	{
+		candidate.meanError /= workload.Num();
+		candidate.microsecondsPerSolve = FPlatformTime::ToMilliseconds64(solveCycles) * 1000.0 / workload.Num();
+	}
+	return candidate;
+}
+
+TArray<UIKAutoTuneCommandlet::FTuneCandidate> UIKAutoTuneCommandlet::paretoFront(const TArray<FTuneCandidate>& candidates)
+{
+	TArray<FTuneCandidate> sorted = candidates;
+	sorted.Sort([](const FTuneCandidate& a, const FTuneCandidate& b)
+	{
+		return a.microsecondsPerSolve != b.microsecondsPerSolve ? a.microsecondsPerSolve < b.microsecondsPerSolve : a.meanError < b.meanError;
+	});
+
+	// walking by increasing time, a candidate is on the front only if it lowers the best error so far.
+	TArray<FTuneCandidate> front;
+	for (const FTuneCandidate& candidate : sorted)
+	{
+		if (front.Num() == 0 || candidate.meanError < front.Last().meanError)
+		{
+			front.Add(candidate);
+		}
+	}
+	return front;
+}
+
+bool UIKAutoTuneCommandlet::writeTunedSettings(const TMap<FString, FString>& tunedSettings)
+{
+	// edited as text, so the rest of the file (and its +/- array syntax) is left untouched.
+	const FString configPath = FPaths::ProjectConfigDir() / TEXT("DefaultGame.ini");
+	const FString sectionHeader = FString::Printf(TEXT("[%s]"), UIK_CCD::autoTuneConfigSection);
+	TArray<FString> lines;
+	FFileHelper::LoadFileToStringArray(lines, *configPath);
+
+	TArray<FString> keptLines;
+	TMap<FString, FString> sectionSettings;
+	bool isInSection = false;
+	for (const FString& line : lines)
+	{
+		const FString trimmedLine = line.TrimStartAndEnd();
+		if (trimmedLine.StartsWith(TEXT("[")))
+		{
+			isInSection = trimmedLine == sectionHeader;
+		}
+		if (!isInSection)
+		{
+			keptLines.Add(line);
+			continue;
+		}
+
+		FString key;
+		FString value;
+		if (trimmedLine.Split(TEXT("="), &key, &value))
+		{
+			sectionSettings.Add(key, value);
+		}
+	}
+
+	sectionSettings.Append(tunedSettings);
+	sectionSettings.KeySort(TLess<FString>());
+
+	while (keptLines.Num() > 0 && keptLines.Last().TrimStartAndEnd().IsEmpty())
+	{
+		keptLines.Pop();
+	}
+	keptLines.Add(FString());
+	keptLines.Add(sectionHeader);
+	for (const TPair<FString, FString>& setting : sectionSettings)
+	{
+		keptLines.Add(setting.Key + TEXT("=") + setting.Value);
+	}
+	keptLines.Add(FString());
+
+	UE_LOG(LogTemp, Display, TEXT("IK auto-tune: writing %d chain settings to %s"), tunedSettings.Num(), *configPath);
+	return FFileHelper::SaveStringArrayToFile(keptLines, *configPath);
+}
@@ -0,0 +1,80 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "IKAutoTuneCommandlet.generated.h"
+
+class UIK_CCD;
+class UPoseableMeshComponent;
+
+
+/**
+ * offline auto-tuner of the per-chain IK solver settings.
+ * for each chain, it replays a target workload (recorded by UIK_CCD::autoTune_recordTargets, or synthetic), sweeps the
+ * threshold and iteration budget, measures the time per solve against the end effector error, and writes the
+ * Pareto-optimal setting that meets the error budget to Config/DefaultGame.ini, where UIK_CCD reads it.
+ *
+ * UnrealEditor-Cmd demo_ik.uproject -run=IKAutoTune
+ *     [-Mesh=/Game/...] [-Chains=hand_l.lowerarm_l.upperarm_l;hand_r.lowerarm_r.upperarm_r]
+ *     [-Samples=256] [-Seed=1] [-Thresholds=0.01,0.1,0.5,1] [-Iterations=1,2,4,6,8,10,16,32] [-MaxError=0.5] [-NoWrite]
+ */
+UCLASS()
+class DEMO_IK_API UIKAutoTuneCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UIKAutoTuneCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+protected:
+	/**
+	* the measured cost and error of one setting over the workload of a chain.
+	**/
+	struct FTuneCandidate
+	{
+		float threshold = 0.0f;
+		int32 iterationCount = 0;
+		double microsecondsPerSolve = 0.0;
+		double meanError = 0.0;
+		double maxError = 0.0;
+	};
+
+	/**
+	* load the recorded workload of a chain (Saved/IKAutoTune/<chain key>.csv), or generate a synthetic one.
+	* @param chainKey: the key of the chain.
+	* @param reachRadius: the reach of the chain, bounding the synthetic targets.
+	* @param sampleCount: the number of synthetic targets, and the maximum number of consecutive recorded ones.
+	* @param seed: the seed of the synthetic targets, for repeatable runs.
+	* @param outIsRecorded: true if the workload is a recording (consecutive frames, in order), false if it is synthetic.
+	* @param outSessionStarts: the index of the first target of each recorded session after the first one.
+	* @return: the targets relative to the chain root, in component space.
+	**/
+	TArray<FVector> loadWorkload(const FString& chainKey, float reachRadius, int32 sampleCount, int32 seed, bool& outIsRecorded,
+			TArray<int32>& outSessionStarts) const;
+
+	/**
+	* solve every target of the workload in order with one setting, starting from the rest pose.
+	* @param warmStart: true to start each solve from the previous result (recorded workloads), false to reset to the rest pose.
+	* @param sessionStarts: the targets that start a new recorded session, solved from the rest pose even when warm-starting.
+	* @return: the measured candidate.
+	**/
+	FTuneCandidate measure(UIK_CCD* solver, UPoseableMeshComponent* skeleton, TArray<FString>& chain, const TArray<FVector>& workload,
+			bool warmStart, const TArray<int32>& sessionStarts, const TArray<FTransform>& restPose, float reachRadius, float threshold,
+			int32 iterationCount) const;
+
+	/**
+	* @return: the candidates not dominated in both time and mean error, sorted by time.
+	**/
+	static TArray<FTuneCandidate> paretoFront(const TArray<FTuneCandidate>& candidates);
+
+	/**
+	* replace the tuned settings section of Config/DefaultGame.ini, keeping the chains that were not tuned in this run.
+	* @param tunedSettings: the settings per chain key.
+	* @return: true if the file was written.
+	**/
+	static bool writeTunedSettings(const TMap<FString, FString>& tunedSettings);
+};
@@ -0,0 +1,201 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "IKSelfCollision.h"
+#include "Components/PoseableMeshComponent.h"
+
+
+namespace
+{
+	FORCEINLINE VectorRegister4Float clamp01(const VectorRegister4Float& value)
+	{
+		return VectorMin(VectorMax(value, VectorZeroFloat()), VectorOneFloat());
+	}
+
+	FORCEINLINE VectorRegister4Float dot3(
+			const VectorRegister4Float& aX, const VectorRegister4Float& aY, const VectorRegister4Float& aZ,
+			const VectorRegister4Float& bX, const VectorRegister4Float& bY, const VectorRegister4Float& bZ)
+	{
+		return VectorMultiplyAdd(aZ, bZ, VectorMultiplyAdd(aY, bY, VectorMultiply(aX, bX)));
+	}
+
+	FORCEINLINE float sumLanes(const VectorRegister4Float& value)
+	{
+		alignas(16) float lanes[4];
+		VectorStoreAligned(value, lanes);
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+}
+
+
+void FIKCapsuleProxySet::build(UPoseableMeshComponent* skeleton, const TArray<FIKCapsuleProxy>& proxies, const TArray<FString>& excludedBoneNames, float segmentRadius)
+{
+	skinnedAsset = skeleton->GetSkinnedAsset();
+	builtExcludedBoneNames = excludedBoneNames;
+	builtSegmentRadius = segmentRadius;
+	capsuleBones.Reset();
+	capsuleRadii.Reset();
+
+	// the chain root is not moved by the solver: a capsule that already contains it would push the chain forever.
+	const FVector chainRoot = excludedBoneNames.Num() > 0
+			? skeleton->GetBoneLocationByName(FName(excludedBoneNames.Last()), EBoneSpaces::ComponentSpace)
+			: FVector::ZeroVector;
+
+	for (const FIKCapsuleProxy& proxy : proxies)
+	{
+		if (excludedBoneNames.Contains(proxy.startBoneName.ToString()) || excludedBoneNames.Contains(proxy.endBoneName.ToString()))
+		{
+			continue;
+		}
+		const int32 startBoneIndex = skeleton->GetBoneIndex(proxy.startBoneName);
+		const int32 endBoneIndex = skeleton->GetBoneIndex(proxy.endBoneName);
+		if (startBoneIndex == INDEX_NONE || endBoneIndex == INDEX_NONE)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("IK self-collision: capsule bones %s, %s not found!"),
+					*proxy.startBoneName.ToString(), *proxy.endBoneName.ToString());
+			continue;
+		}
+
+		float radius = proxy.radius;
+		if (excludedBoneNames.Num() > 0)
+		{
+			const FVector closestPoint = FMath::ClosestPointOnSegment(chainRoot,
+					skeleton->GetBoneLocationByName(proxy.startBoneName, EBoneSpaces::ComponentSpace),
+					skeleton->GetBoneLocationByName(proxy.endBoneName, EBoneSpaces::ComponentSpace));
+			const float clearance = FVector::Dist(chainRoot, closestPoint) - segmentRadius;
+			if (radius > clearance)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("IK self-collision: capsule %s, %s contains the chain root %s, radius reduced from %.1f to %.1f"),
+						*proxy.startBoneName.ToString(), *proxy.endBoneName.ToString(), *excludedBoneNames.Last(), radius, FMath::Max(clearance, 0.0f));
+				radius = FMath::Max(clearance, 0.0f);
+			}
+		}
+		capsuleBones.Emplace(startBoneIndex, endBoneIndex);
+		capsuleRadii.Add(radius);
+	}
+
+	blocks.SetNumZeroed((capsuleBones.Num() + 3) / 4);
+}
+
+bool FIKCapsuleProxySet::isBuiltFor(const UPoseableMeshComponent* skeleton, const TArray<FString>& excludedBoneNames, float segmentRadius) const
+{
+	return skinnedAsset && skinnedAsset == skeleton->GetSkinnedAsset() && builtExcludedBoneNames == excludedBoneNames
+		&& builtSegmentRadius == segmentRadius;
+}
+
+void FIKCapsuleProxySet::update(UPoseableMeshComponent* skeleton)
+{
+	origin = skeleton->GetComponentLocation();
+
+	for (int32 blockIndex = 0; blockIndex < blocks.Num(); ++blockIndex)
+	{
+		alignas(16) float lanes[7][4];
+		for (int32 lane = 0; lane < 4; ++lane)
+		{
+			const int32 c = blockIndex * 4 + lane;
+			if (c >= capsuleBones.Num())
+			{
+				// padding lane: a negative radius never overlaps anything.
+				for (int32 k = 0; k < 6; ++k)
+				{
+					lanes[k][lane] = 0.0f;
+				}
+				lanes[6][lane] = -UE_BIG_NUMBER;
+				continue;
+			}
+			// from the bone space pose: the cached transforms lag behind the bones set since the last refresh.
+			const FVector start = skeleton->GetBoneLocationByName(skeleton->GetBoneName(capsuleBones[c].Key), EBoneSpaces::WorldSpace) - origin;
+			const FVector axis = skeleton->GetBoneLocationByName(skeleton->GetBoneName(capsuleBones[c].Value), EBoneSpaces::WorldSpace) - origin - start;
+			lanes[0][lane] = start.X;
+			lanes[1][lane] = start.Y;
+			lanes[2][lane] = start.Z;
+			lanes[3][lane] = axis.X;
+			lanes[4][lane] = axis.Y;
+			lanes[5][lane] = axis.Z;
+			lanes[6][lane] = capsuleRadii[c];
+		}
+
+		FCapsuleBlock& block = blocks[blockIndex];
+		block.startX = VectorLoadAligned(lanes[0]);
+		block.startY = VectorLoadAligned(lanes[1]);
+		block.startZ = VectorLoadAligned(lanes[2]);
+		block.axisX = VectorLoadAligned(lanes[3]);
+		block.axisY = VectorLoadAligned(lanes[4]);
+		block.axisZ = VectorLoadAligned(lanes[5]);
+		block.radius = VectorLoadAligned(lanes[6]);
+	}
+}
+
+bool FIKCapsuleProxySet::computePushOut(const FVector& segmentStart, const FVector& segmentEnd, float segmentRadius, FVector& outPush) const
+{
+	outPush = FVector::ZeroVector;
+	if (blocks.Num() == 0)
+	{
+		return false;
+	}
+
+	// the chain segment is broadcast to every lane.
+	const FVector start = segmentStart - origin;
+	const FVector axis = segmentEnd - segmentStart;
+	const float axisLengthSquared = FMath::Max(static_cast<float>(axis.SizeSquared()), UE_SMALL_NUMBER);
+	const VectorRegister4Float p1X = VectorSetFloat1(static_cast<float>(start.X));
+	const VectorRegister4Float p1Y = VectorSetFloat1(static_cast<float>(start.Y));
+	const VectorRegister4Float p1Z = VectorSetFloat1(static_cast<float>(start.Z));
+	const VectorRegister4Float d1X = VectorSetFloat1(static_cast<float>(axis.X));
+	const VectorRegister4Float d1Y = VectorSetFloat1(static_cast<float>(axis.Y));
+	const VectorRegister4Float d1Z = VectorSetFloat1(static_cast<float>(axis.Z));
+	const VectorRegister4Float a = VectorSetFloat1(axisLengthSquared);
+	const VectorRegister4Float invA = VectorSetFloat1(1.0f / axisLengthSquared);
+	const VectorRegister4Float chainRadius = VectorSetFloat1(segmentRadius);
+	const VectorRegister4Float epsilon = VectorSetFloat1(UE_SMALL_NUMBER);
+	const VectorRegister4Float zero = VectorZeroFloat();
+	// contacts closer to the segment start than this fraction cannot be pushed out by rotating the segment about its start.
+	const VectorRegister4Float minLever = VectorSetFloat1(0.2f);
+
+	VectorRegister4Float pushX = zero;
+	VectorRegister4Float pushY = zero;
+	VectorRegister4Float pushZ = zero;
+
+	for (const FCapsuleBlock& block : blocks)
+	{
+		// closest points between the segment p1 + s * d1 and the capsule axes p2 + t * d2 (Ericson, 5.1.9), branchless.
+		const VectorRegister4Float rX = VectorSubtract(p1X, block.startX);
+		const VectorRegister4Float rY = VectorSubtract(p1Y, block.startY);
+		const VectorRegister4Float rZ = VectorSubtract(p1Z, block.startZ);
+		const VectorRegister4Float e = VectorMax(dot3(block.axisX, block.axisY, block.axisZ, block.axisX, block.axisY, block.axisZ), epsilon);
+		const VectorRegister4Float f = dot3(block.axisX, block.axisY, block.axisZ, rX, rY, rZ);
+		const VectorRegister4Float c = dot3(d1X, d1Y, d1Z, rX, rY, rZ);
+		const VectorRegister4Float b = dot3(d1X, d1Y, d1Z, block.axisX, block.axisY, block.axisZ);
+
+		// s on the infinite lines, the segment end for parallel lines (any s is closest, the end gives the most leverage).
+		const VectorRegister4Float denominator = VectorSubtract(VectorMultiply(a, e), VectorMultiply(b, b));
+		const VectorRegister4Float isParallel = VectorCompareLT(denominator, epsilon);
+		VectorRegister4Float s = clamp01(VectorDivide(
+				VectorSubtract(VectorMultiply(b, f), VectorMultiply(c, e)),
+				VectorMax(denominator, epsilon)));
+		s = VectorSelect(isParallel, VectorOneFloat(), s);
+
+		// t for that s, and s again where t had to be clamped.
+		const VectorRegister4Float unclampedT = VectorDivide(VectorMultiplyAdd(b, s, f), e);
+		const VectorRegister4Float t = clamp01(unclampedT);
+		const VectorRegister4Float clampedS = clamp01(VectorMultiply(VectorSubtract(VectorMultiply(b, t), c), invA));
+		s = VectorSelect(VectorCompareNE(t, unclampedT), clampedS, s);
+
+		// from the capsule axis to the segment.
+		const VectorRegister4Float diffX = VectorSubtract(VectorMultiplyAdd(d1X, s, p1X), VectorMultiplyAdd(block.axisX, t, block.startX));
+		const VectorRegister4Float diffY = VectorSubtract(VectorMultiplyAdd(d1Y, s, p1Y), VectorMultiplyAdd(block.axisY, t, block.startY));
+		const VectorRegister4Float diffZ = VectorSubtract(VectorMultiplyAdd(d1Z, s, p1Z), VectorMultiplyAdd(block.axisZ, t, block.startZ));
+		const VectorRegister4Float distance = VectorSqrt(VectorMax(dot3(diffX, diffY, diffZ, diffX, diffY, diffZ), epsilon));
+
+		// push along the separating direction by the penetration depth, only in the overlapping lanes. the push applies to
+		// the closest point at s, the segment end has to move 1 / s times as far; contacts next to the start are skipped.
+		const VectorRegister4Float penetration = VectorSubtract(VectorAdd(block.radius, chainRadius), distance);
+		const VectorRegister4Float isResolvable = VectorBitwiseAnd(VectorCompareGT(penetration, zero), VectorCompareGE(s, minLever));
+		const VectorRegister4Float pushScale = VectorSelect(isResolvable, VectorDivide(penetration, VectorMultiply(distance, VectorMax(s, minLever))), zero);
+		pushX = VectorMultiplyAdd(diffX, pushScale, pushX);
+		pushY = VectorMultiplyAdd(diffY, pushScale, pushY);
+		pushZ = VectorMultiplyAdd(diffZ, pushScale, pushZ);
+	}
+
+	outPush = FVector(sumLanes(pushX), sumLanes(pushY), sumLanes(pushZ));
+	return !outPush.IsNearlyZero();
+}
@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Math/VectorRegister.h"
+#include "IKSelfCollision.generated.h"
+
+class UPoseableMeshComponent;
+class USkinnedAsset;
+
+
+/**
+ * a capsule attached to the skeleton, spanning from one bone to another (both can be the same bone).
+ * used as a cheap proxy of the body for the IK self-collision.
+ */
+USTRUCT(BlueprintType)
+struct FIKCapsuleProxy
+{
+	GENERATED_BODY()
+
+	FIKCapsuleProxy() {}
+	FIKCapsuleProxy(FName inStartBoneName, FName inEndBoneName, float inRadius)
+		: startBoneName(inStartBoneName), endBoneName(inEndBoneName), radius(inRadius) {}
+
+	UPROPERTY(EditAnywhere, Category = "IK self-collision")
+	FName startBoneName;
+
+	UPROPERTY(EditAnywhere, Category = "IK self-collision")
+	FName endBoneName;
+
+	UPROPERTY(EditAnywhere, Category = "IK self-collision")
+	float radius = 10.0f;
+};
+
+
+/**
+ * the capsule proxies of a skeleton packed in blocks of 4 (one capsule per SIMD lane), so that a chain segment
+ * is tested against 4 capsules at once.
+ */
+class DEMO_IK_API FIKCapsuleProxySet
+{
+public:
+	/**
+	* resolve the proxies against a skeleton. capsules attached to an excluded bone are dropped, and capsules that
+	* contain the chain root in the current pose are shrunk to clear it (no rotation of the chain can move its root).
+	* @param skeleton: the posable mesh the proxies are attached to.
+	* @param proxies: the capsule proxies of the skeleton.
+	* @param excludedBoneNames: the bones of the solved chain, from the end effector to the chain root, which must not collide with themselves.
+	* @param segmentRadius: the thickness of the chain segments.
+	**/
+	void build(UPoseableMeshComponent* skeleton, const TArray<FIKCapsuleProxy>& proxies, const TArray<FString>& excludedBoneNames, float segmentRadius);
+
+	/**
+	* @return: true if the set was built for this skeleton, chain and segment thickness.
+	**/
+	bool isBuiltFor(const UPoseableMeshComponent* skeleton, const TArray<FString>& excludedBoneNames, float segmentRadius) const;
+
+	/**
+	* move the packed capsules to the current pose of their bones.
+	* @param skeleton: the posable mesh the proxies are attached to.
+	**/
+	void update(UPoseableMeshComponent* skeleton);
+
+	/**
+	* test a chain segment against all the capsules and sum the displacements of the segment end that push it out of them,
+	* when the segment rotates about its start. each contact is scaled by the inverse of its position along the segment;
+	* contacts next to the start cannot be resolved by this segment and are ignored.
+	* @param segmentStart: the segment start, in world space.
+	* @param segmentEnd: the segment end, in world space.
+	* @param segmentRadius: the thickness of the segment.
+	* @param outPush: the sum of the segment end displacements.
+	* @return: true if the segment penetrates at least one capsule it can rotate out of.
+	**/
+	bool computePushOut(const FVector& segmentStart, const FVector& segmentEnd, float segmentRadius, FVector& outPush) const;
+
+	int32 num() const { return capsuleBones.Num(); }
+
+protected:
+	/**
+	* 4 capsules in SoA layout: the start point, the axis (end - start) and the radius of each lane.
+	* unused lanes have a negative radius so they never collide.
+	**/
+	struct FCapsuleBlock
+	{
+		VectorRegister4Float startX;
+		VectorRegister4Float startY;
+		VectorRegister4Float startZ;
+		VectorRegister4Float axisX;
+		VectorRegister4Float axisY;
+		VectorRegister4Float axisZ;
+		VectorRegister4Float radius;
+	};
+
+	const USkinnedAsset* skinnedAsset = nullptr;
+	TArray<FString> builtExcludedBoneNames;
+	float builtSegmentRadius = 0.0f;
+	// the start and end bone indices of each capsule.
+	TArray<TPair<int32, int32>> capsuleBones;
+	TArray<float> capsuleRadii;
+	TArray<FCapsuleBlock> blocks;
+	// the capsules are stored relative to the component location, to keep float precision far from the origin.
+	FVector origin = FVector::ZeroVector;
+};
@@ -0,0 +1,200 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "IKTargetStream.h"
+#include "IKTargetStreamProtocol.h"
+#include "HAL/IConsoleManager.h"
+#include "Engine/World.h"
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+static TAutoConsoleVariable<FString> CVarTargetStreamName(
+	TEXT("ik.TargetStream.Name"),
+	ANSI_TO_TCHAR(IKTargetStream::DefaultName),
+	TEXT("name of the POSIX shared memory segment the IK targets are streamed through."));
+
+static TAutoConsoleVariable<float> CVarTargetStreamTimeout(
+	TEXT("ik.TargetStream.Timeout"),
+	1.0f,
+	TEXT("seconds without a new frame after which the IK target stream producer is considered gone and disconnected."));
+
+
+void UIKTargetStreamSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+	worldTickStartHandle = FWorldDelegates::OnWorldTickStart.AddUObject(this, &UIKTargetStreamSubsystem::onWorldTickStart);
+}
+
+void UIKTargetStreamSubsystem::Deinitialize()
+{
+	FWorldDelegates::OnWorldTickStart.Remove(worldTickStartHandle);
+	closeSegment();
+	Super::Deinitialize();
+}
+
+bool UIKTargetStreamSubsystem::openSegment()
+{
+#if PLATFORM_LINUX || PLATFORM_MAC
+	const FString segmentName = CVarTargetStreamName.GetValueOnGameThread();
+	const int fileDescriptor = shm_open(TCHAR_TO_ANSI(*segmentName), O_RDONLY, 0);
+	if (fileDescriptor < 0)
+	{
+		// the producer is not running (yet).
+		return false;
+	}
+
+	struct stat segmentStat;
+	if (fstat(fileDescriptor, &segmentStat) != 0 || segmentStat.st_size < static_cast<off_t>(sizeof(IKTargetStream::Header)))
+	{
+		close(fileDescriptor);
+		return false;
+	}
+
+	// the mapping stays valid after the descriptor is closed.
+	void* segment = mmap(nullptr, segmentStat.st_size, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+	close(fileDescriptor);
+	if (segment == MAP_FAILED)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("IK target stream: could not map %s"), *segmentName);
+		return false;
+	}
+
+	// the dimensions are read once, every later access is bounded by these copies (the slot count is checked by
+	// division so a corrupt header cannot overflow the size computation).
+	const IKTargetStream::Header* segmentHeader = static_cast<const IKTargetStream::Header*>(segment);
+	const uint32 segmentSlotCount = segmentHeader->slotCount;
+	const uint32 segmentMaxStreams = segmentHeader->maxStreams;
+	const uint64 segmentGeneration = segmentHeader->generation;
+	if (segmentHeader->magic != IKTargetStream::Magic || segmentHeader->version != IKTargetStream::Version
+		|| segmentSlotCount == 0
+		|| segmentSlotCount > (static_cast<size_t>(segmentStat.st_size) - sizeof(IKTargetStream::Header)) / IKTargetStream::slotSize(segmentMaxStreams))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("IK target stream: %s is not a valid target stream (version %u expected)"), *segmentName, IKTargetStream::Version);
+		munmap(segment, segmentStat.st_size);
+		return false;
+	}
+
+	// the segment of a producer that stopped, or that went silent without removing it.
+	if (segmentHeader->isProducing.load(std::memory_order_acquire) == 0 || segmentGeneration == staleGeneration)
+	{
+		munmap(segment, segmentStat.st_size);
+		return false;
+	}
+
+	mapping = segment;
+	mappingSize = segmentStat.st_size;
+	header = segmentHeader;
+	slotCount = segmentSlotCount;
+	maxStreams = segmentMaxStreams;
+	generation = segmentGeneration;
+	lastPublishedFrames = header->publishedFrames.load(std::memory_order_acquire);
+	lastPublishTime = FPlatformTime::Seconds();
+	UE_LOG(LogTemp, Log, TEXT("IK target stream: connected to %s (%u streams, %u frames, generation %llx)"),
+			*segmentName, maxStreams, slotCount, generation);
+	return true;
+#else
+	return false;
+#endif
+}
+
+void UIKTargetStreamSubsystem::closeSegment()
+{
+#if PLATFORM_LINUX || PLATFORM_MAC
+	if (mapping)
+	{
+		munmap(mapping, mappingSize);
+	}
+#endif
+	mapping = nullptr;
+	mappingSize = 0;
+	header = nullptr;
+	slotCount = 0;
+	maxStreams = 0;
+	generation = 0;
+	pinnedSlot = nullptr;
+	pinnedSequence = 0;
+}
+
+void UIKTargetStreamSubsystem::onWorldTickStart(UWorld* world, ELevelTick tickType, float deltaTime)
+{
+	if (world != GetWorld())
+	{
+		return;
+	}
+
+	if (header)
+	{
+		// the producer stopped, or published nothing for too long (killed, or restarted under a new segment).
+		const uint64 publishedFrames = header->publishedFrames.load(std::memory_order_acquire);
+		const double currentTime = FPlatformTime::Seconds();
+		if (publishedFrames != lastPublishedFrames)
+		{
+			lastPublishedFrames = publishedFrames;
+			lastPublishTime = currentTime;
+		}
+		if (header->isProducing.load(std::memory_order_acquire) == 0)
+		{
+			UE_LOG(LogTemp, Log, TEXT("IK target stream: the producer stopped, disconnected"));
+			closeSegment();
+		}
+		else if (currentTime - lastPublishTime > CVarTargetStreamTimeout.GetValueOnGameThread())
+		{
+			UE_LOG(LogTemp, Log, TEXT("IK target stream: no frame for %.1f s, disconnected"), currentTime - lastPublishTime);
+			staleGeneration = generation;
+			closeSegment();
+		}
+	}
+
+	if (!header)
+	{
+		const double currentTime = FPlatformTime::Seconds();
+		if (currentTime - lastOpenAttemptTime < 1.0)
+		{
+			return;
+		}
+		lastOpenAttemptTime = currentTime;
+		if (!openSegment())
+		{
+			return;
+		}
+	}
+
+	// pin the latest complete frame, the targets themselves are read in place by the IK components.
+	const uint64 publishedFrames = header->publishedFrames.load(std::memory_order_acquire);
+	if (publishedFrames == 0)
+	{
+		pinnedSlot = nullptr;
+		return;
+	}
+	const uint64 frame = publishedFrames - 1;
+	pinnedSlot = IKTargetStream::slotOf(header, slotCount, maxStreams, frame);
+	pinnedSequence = IKTargetStream::completeSequence(frame);
+}
+
+bool UIKTargetStreamSubsystem::getTargetPosition(int32 streamId, FVector& outPosition) const
+{
+	if (!pinnedSlot || streamId < 0 || static_cast<uint32>(streamId) >= maxStreams)
+	{
+		return false;
+	}
+
+	// seqlock read: the target is only valid if the producer did not start rewriting the slot meanwhile.
+	if (pinnedSlot->sequence.load(std::memory_order_acquire) != pinnedSequence)
+	{
+		return false;
+	}
+	const IKTargetStream::Target target = IKTargetStream::targetsOf(pinnedSlot)[streamId];
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (pinnedSlot->sequence.load(std::memory_order_relaxed) != pinnedSequence || target.valid == 0)
+	{
+		return false;
+	}
+
+	outPosition = FVector(target.x, target.y, target.z);
+	return true;
+}
@@ -0,0 +1,88 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "IKTargetStream.generated.h"
+
+namespace IKTargetStream
+{
+	struct Header;
+	struct SlotHeader;
+}
+
+
+/**
+ * input provider for IK targets streamed by an external process (mocap, simulation) on the same host.
+ * it maps the POSIX shared memory ring written by a single producer (see IKTargetStreamProtocol.h), pins the latest
+ * complete frame at the start of each world tick, and lets the IK components read their target straight from the
+ * mapping by stream ID. it disconnects when the producer stops or goes silent for ik.TargetStream.Timeout seconds,
+ * and connects to the next producer run. the segment name is set with ik.TargetStream.Name; only available on POSIX platforms.
+ */
+UCLASS()
+class DEMO_IK_API UIKTargetStreamSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	/**
+	* read the target of a stream from the pinned frame.
+	* @param streamId: the stream ID (the index of the target in the frame).
+	* @param outPosition: the target position in world space.
+	* @return: true if the stream has a valid target in the pinned frame, false if it has none or the producer
+	* overwrote the frame while it was read.
+	**/
+	bool getTargetPosition(int32 streamId, FVector& outPosition) const;
+
+	/**
+	* @return: true if the shared memory segment is mapped.
+	**/
+	bool isConnected() const { return header != nullptr; }
+
+protected:
+	/**
+	* map the shared memory segment, if the producer has created it.
+	* @return: true if the segment is mapped and valid.
+	**/
+	bool openSegment();
+
+	/**
+	* unmap the shared memory segment.
+	**/
+	void closeSegment();
+
+	/**
+	* connect or disconnect as the producer starts and stops, and pin the latest complete frame.
+	* called at the start of the world tick, before any component reads a target.
+	**/
+	void onWorldTickStart(UWorld* world, ELevelTick tickType, float deltaTime);
+
+	const IKTargetStream::Header* header = nullptr;
+	void* mapping = nullptr;
+	SIZE_T mappingSize = 0;
+
+	// the ring dimensions, copied and checked against mappingSize on open: the producer can still write the header.
+	uint32 slotCount = 0;
+	uint32 maxStreams = 0;
+	uint64 generation = 0;
+
+	// the producer run that went silent, its segment is not connected to again.
+	uint64 staleGeneration = 0;
+
+	// the published frame count at the last check, and the platform time it last changed.
+	uint64 lastPublishedFrames = 0;
+	double lastPublishTime = 0.0;
+
+	// the latest complete frame at the start of the tick, read by the IK components during the frame.
+	IKTargetStream::SlotHeader* pinnedSlot = nullptr;
+	uint64 pinnedSequence = 0;
+
+	// the platform time of the last attempt to open the segment (it is retried every second until the producer runs).
+	double lastOpenAttemptTime = TNumericLimits<double>::Lowest();
+
+	FDelegateHandle worldTickStartHandle;
+};
@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+// the shared memory layout of the IK target stream. it is shared with the standalone producer tool
+// (Source/IKTargetProducer), so it only depends on the standard library.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace IKTargetStream
+{
+	constexpr uint32_t Magic = 0x53544B49; // "IKTS"
+	constexpr uint32_t Version = 2;
+	constexpr const char* DefaultName = "/demo_ik_targets";
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+			"the target stream needs lock-free atomics");
+
+	/**
+	* the segment header, written once by the producer before the first frame.
+	* the producer unlinks any previous segment and creates a new one, it never resizes a segment a reader may have mapped.
+	**/
+	struct alignas(64) Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		// the number of frames in the ring.
+		uint32_t slotCount;
+		// the number of targets per frame: the target of stream ID i is at index i.
+		uint32_t maxStreams;
+		// a non-zero ID of the producer run that created the segment, it changes when the producer restarts.
+		uint64_t generation;
+		// the number of frames published so far, frame n lives in slot n % slotCount.
+		std::atomic<uint64_t> publishedFrames;
+		// 1 while the producer runs, set to 0 when it stops cleanly.
+		std::atomic<uint32_t> isProducing;
+	};
+
+	/**
+	* one target position, in world space (cm).
+	**/
+	struct Target
+	{
+		float x;
+		float y;
+		float z;
+		// 0 if the stream has no target in this frame.
+		uint32_t valid;
+	};
+
+	/**
+	* the header of a frame slot, followed by maxStreams targets.
+	**/
+	struct alignas(64) SlotHeader
+	{
+		// seqlock: 2n + 1 while frame n is being written, 2n + 2 once it is complete.
+		std::atomic<uint64_t> sequence;
+	};
+
+	inline size_t slotSize(uint32_t maxStreams)
+	{
+		return (sizeof(SlotHeader) + maxStreams * sizeof(Target) + 63) & ~size_t(63);
+	}
+
+	inline size_t segmentSize(uint32_t slotCount, uint32_t maxStreams)
+	{
+		return sizeof(Header) + slotCount * slotSize(maxStreams);
+	}
+
+	/**
+	* the slot of a frame. the ring dimensions are passed by the caller, so a reader uses the values it validated
+	* against the segment size rather than the header, which the producer can still write.
+	**/
+	inline SlotHeader* slotOf(const Header* header, uint32_t slotCount, uint32_t maxStreams, uint64_t frame)
+	{
+		const uint8_t* base = reinterpret_cast<const uint8_t*>(header) + sizeof(Header);
+		return reinterpret_cast<SlotHeader*>(const_cast<uint8_t*>(base + (frame % slotCount) * slotSize(maxStreams)));
+	}
+
+	inline Target* targetsOf(SlotHeader* slot)
+	{
+		return reinterpret_cast<Target*>(slot + 1);
+	}
+
+	inline uint64_t completeSequence(uint64_t frame)
+	{
+		return 2 * frame + 2;
+	}
+}
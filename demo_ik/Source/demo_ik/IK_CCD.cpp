@@ -1,6 +1,16 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "IK_CCD.h"
+#include "PoseSharing.h"
+#include "IKTargetStream.h"
+#include "Misc/ConfigCacheIni.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Engine/SkinnedAsset.h"
+
+
+const TCHAR* UIK_CCD::autoTuneConfigSection = TEXT("/Script/demo_ik.IKAutoTune");
+const TCHAR* UIK_CCD::autoTuneSessionSeparator = TEXT("# session");
 
 
 // Sets default values for this component's properties
@@ -12,31 +22,87 @@ UIK_CCD::UIK_CCD()
 	PosableCharacter = Cast<AAPosableCharacter>(GetOwner());
 }
 
-void UIK_CCD::Solve(UPoseableMeshComponent* skeleton, const FVector& targetPosition, TArray<FString>& boneNames, float threshold, int iterationCount)
+FIK_CCDResult UIK_CCD::Solve(UPoseableMeshComponent* skeleton, const FVector& targetPosition, TArray<FString>& boneNames, float threshold, int iterationCount)
 {
+	FIK_CCDResult result;
+
 	// check if there are bones to rotate
 	if (boneNames.Num() == 0)
 	{
 		UE_LOG(LogTemp, Warning, TEXT("no bone vectors found for CCD"));
-		return;
+		return result;
+	}
+
+	// the bones are read with the ByName getters, computed from the bone space pose: the cached component space
+	// transforms are only refreshed once per frame and would not see the rotations set during the solve.
+	const FName endBoneName = FName(boneNames[0]);
+	const FVector rootBonePos = skeleton->GetBoneLocationByName(FName(boneNames.Last()), EBoneSpaces::WorldSpace);
+	const FVector rootToTarget = targetPosition - rootBonePos;
+	const float targetDistance = rootToTarget.Size();
+
+	// compare the target with the precomputed reach of the chain, scaled like the component.
+	const FIK_CCDReachData& reach = getReachData(skeleton, boneNames);
+	const float componentScale = skeleton->GetComponentTransform().GetMaximumAxisScale();
+	const float reachRadius = reach.totalLength * componentScale;
+	const float innerRadius = reach.innerRadius * componentScale;
+
+	// the capsule proxies do not move with the chain, place them once per solve.
+	const AAPosableCharacter* owningCharacter = Cast<AAPosableCharacter>(skeleton->GetOwner());
+	const bool hasSelfCollision = selfCollision_enabled && owningCharacter && boneNames.Num() > 1;
+	if (hasSelfCollision)
+	{
+		if (!selfCollision_proxies.isBuiltFor(skeleton, boneNames, selfCollision_chainRadius))
+		{
+			selfCollision_proxies.build(skeleton, owningCharacter->selfCollision_capsules, boneNames, selfCollision_chainRadius);
+		}
+		selfCollision_proxies.update(skeleton);
+	}
+
+	// out of reach, or within the threshold of full extension (where CCD converges the slowest): the best pose is the
+	// chain straightened towards the target, no need to iterate.
+	if (boneNames.Num() > 1 && targetDistance >= reachRadius - threshold)
+	{
+		straightenChain(skeleton, boneNames, rootToTarget);
+		if (hasSelfCollision)
+		{
+			resolveSelfCollision(skeleton, boneNames);
+		}
+		result.iterations = 1;
+		result.error = FVector::Dist(skeleton->GetBoneLocationByName(endBoneName, EBoneSpaces::WorldSpace), targetPosition);
+		result.outcome = result.error < threshold ? EIK_CCDOutcome::Reached : EIK_CCDOutcome::OutOfReach;
+		return result;
+	}
+
+	// too close: solve for the closest reachable point instead, on the inner sphere.
+	FVector solveTarget = targetPosition;
+	if (targetDistance < innerRadius)
+	{
+		const FVector direction = targetDistance > UE_KINDA_SMALL_NUMBER
+				? rootToTarget / targetDistance
+				: (skeleton->GetBoneLocationByName(endBoneName, EBoneSpaces::WorldSpace) - rootBonePos).GetSafeNormal();
+		solveTarget = rootBonePos + direction * innerRadius;
+		result.outcome = EIK_CCDOutcome::TooClose;
 	}
 
 	// iteratively approximate a solution
-	for (int i = 0; i < iterationCount; i++)
+	bool hasReached = false;
+	for (int i = 0; i < iterationCount && !hasReached; i++)
 	{
+		result.iterations = i + 1;
 		for (int b = 0; b < boneNames.Num(); b++) {
 			// end effector
-			FVector endBonePos = skeleton->GetBoneLocation(FName(boneNames[0],  EBoneSpaces::WorldSpace));
+			FVector endBonePos = skeleton->GetBoneLocationByName(endBoneName, EBoneSpaces::WorldSpace);
 
 			// check if the end effector is close enough to the target
-			if (FVector::Dist(endBonePos, targetPosition) < threshold) {
-				return;
+			if (FVector::Dist(endBonePos, solveTarget) < threshold) {
+				hasReached = true;
+				break;
 			}
 
 			FName currentBoneName = FName(boneNames[b]);
-			FVector currentBonePos = skeleton->GetBoneLocation(currentBoneName, EBoneSpaces::WorldSpace);
-			FQuat currentBoneRot = skeleton->GetBoneQuaternion(currentBoneName, EBoneSpaces::WorldSpace);
-			FVector targetDirection = (targetPosition - currentBonePos);
+			FVector currentBonePos = skeleton->GetBoneLocationByName(currentBoneName, EBoneSpaces::WorldSpace);
+			FQuat currentBoneRot = skeleton->GetBoneTransformByName(currentBoneName, EBoneSpaces::WorldSpace).GetRotation();
+			FVector targetDirection = (solveTarget - currentBonePos);
 			FVector endBoneDirection = (endBonePos - currentBonePos);
 
 			// determine and apply the appropriate rotation towards the target
@@ -44,7 +110,170 @@ void UIK_CCD::Solve(UPoseableMeshComponent* skeleton, const FVector& targetPosit
 			skeleton->SetBoneRotationByName(currentBoneName, newBoneRot.Rotator(), EBoneSpaces::WorldSpace);
 		}
 
+		if (hasSelfCollision && !hasReached)
+		{
+			resolveSelfCollision(skeleton, boneNames);
+		}
+	}
+
+	// reaching the target breaks out of an iteration before its push-out, the bones rotated so far may be inside the body.
+	if (hasSelfCollision && hasReached)
+	{
+		resolveSelfCollision(skeleton, boneNames);
+		hasReached = FVector::Dist(skeleton->GetBoneLocationByName(endBoneName, EBoneSpaces::WorldSpace), solveTarget) < threshold;
+	}
+
+	if (result.outcome != EIK_CCDOutcome::TooClose)
+	{
+		result.outcome = hasReached ? EIK_CCDOutcome::Reached : EIK_CCDOutcome::NotConverged;
 	}
+	result.error = FVector::Dist(skeleton->GetBoneLocationByName(endBoneName, EBoneSpaces::WorldSpace), targetPosition);
+	return result;
+}
+
+const FIK_CCDReachData& UIK_CCD::getReachData(UPoseableMeshComponent* skeleton, const TArray<FString>& boneNames)
+{
+	const USkinnedAsset* skinnedAsset = skeleton->GetSkinnedAsset();
+	if (reachData.skinnedAsset == skinnedAsset && reachData.boneNames == boneNames)
+	{
+		return reachData;
+	}
+
+	// the segment lengths do not change with the rotations, measure them once in component space.
+	reachData.skinnedAsset = skinnedAsset;
+	reachData.boneNames = boneNames;
+	reachData.totalLength = 0.0f;
+	float longestSegment = 0.0f;
+	for (int b = 1; b < boneNames.Num(); b++)
+	{
+		const float segmentLength = FVector::Dist(
+				skeleton->GetBoneLocationByName(FName(boneNames[b - 1]), EBoneSpaces::ComponentSpace),
+				skeleton->GetBoneLocationByName(FName(boneNames[b]), EBoneSpaces::ComponentSpace));
+		reachData.totalLength += segmentLength;
+		longestSegment = FMath::Max(longestSegment, segmentLength);
+	}
+	// the chain can only fold back onto itself up to the difference between its longest segment and the others.
+	reachData.innerRadius = FMath::Max(0.0f, 2.0f * longestSegment - reachData.totalLength);
+	return reachData;
+}
+
+void UIK_CCD::straightenChain(UPoseableMeshComponent* skeleton, const TArray<FString>& boneNames, const FVector& direction)
+{
+	// from the root to the end effector, so each bone is aligned after its parents.
+	for (int b = boneNames.Num() - 1; b > 0; b--)
+	{
+		FName currentBoneName = FName(boneNames[b]);
+		FVector currentBonePos = skeleton->GetBoneLocationByName(currentBoneName, EBoneSpaces::WorldSpace);
+		FVector childBonePos = skeleton->GetBoneLocationByName(FName(boneNames[b - 1]), EBoneSpaces::WorldSpace);
+		FQuat currentBoneRot = skeleton->GetBoneTransformByName(currentBoneName, EBoneSpaces::WorldSpace).GetRotation();
+
+		FQuat newBoneRot = FQuat::FindBetweenVectors(childBonePos - currentBonePos, direction) * currentBoneRot;
+		skeleton->SetBoneRotationByName(currentBoneName, newBoneRot.Rotator(), EBoneSpaces::WorldSpace);
+	}
+}
+
+void UIK_CCD::resolveSelfCollision(UPoseableMeshComponent* skeleton, const TArray<FString>& boneNames)
+{
+	// from the root to the end effector: rotating a bone moves the end of its segment out of the capsules.
+	for (int b = boneNames.Num() - 1; b > 0; b--)
+	{
+		FName currentBoneName = FName(boneNames[b]);
+		FVector currentBonePos = skeleton->GetBoneLocationByName(currentBoneName, EBoneSpaces::WorldSpace);
+		FVector childBonePos = skeleton->GetBoneLocationByName(FName(boneNames[b - 1]), EBoneSpaces::WorldSpace);
+
+		FVector push;
+		if (!selfCollision_proxies.computePushOut(currentBonePos, childBonePos, selfCollision_chainRadius, push))
+		{
+			continue;
+		}
+
+		FQuat currentBoneRot = skeleton->GetBoneTransformByName(currentBoneName, EBoneSpaces::WorldSpace).GetRotation();
+		FQuat newBoneRot = FQuat::FindBetweenVectors(childBonePos - currentBonePos, childBonePos + push - currentBonePos) * currentBoneRot;
+		skeleton->SetBoneRotationByName(currentBoneName, newBoneRot.Rotator(), EBoneSpaces::WorldSpace);
+	}
+}
+
+void UIK_CCD::solveShared(TArray<FString>& boneNames, const FVector& targetPosition)
+{
+	UPoseSharingSubsystem* poseSharing = GetWorld()->GetSubsystem<UPoseSharingSubsystem>();
+	if (!poseSharing || !PosableCharacter || boneNames.Num() == 0)
+	{
+		lastSolveResult = Solve(PosableMesh, targetPosition, boneNames, solve_threshold, solve_iterationCount);
+		return;
+	}
+
+	// the target relative to the chain root (the last bone of the chain), in component space.
+	const FVector target_componentSpace = PosableMesh->GetComponentTransform().InverseTransformPosition(targetPosition);
+	const FVector root_componentSpace = PosableMesh->GetBoneLocationByName(FName(boneNames.Last()), EBoneSpaces::ComponentSpace);
+	const FIntVector quantizedTarget = UPoseSharingSubsystem::quantizeLocation(target_componentSpace - root_componentSpace);
+
+	TArray<int32> boneIndices;
+	for (const FString& boneName : boneNames)
+	{
+		boneIndices.Add(PosableMesh->GetBoneIndex(FName(boneName)));
+	}
+
+	// the full key is compared by the subsystem, characters only share a pose if all of it is equal.
+	FPoseSharingKey poseKey;
+	poseKey.appendValue(PosableMesh->GetSkinnedAsset());
+	poseKey.appendKey(PosableCharacter->proceduralMotion_poseKey);
+	poseKey.appendValue(boneIndices.Num());
+	poseKey.append(boneIndices.GetData(), boneIndices.Num() * sizeof(int32));
+	poseKey.appendValue(quantizedTarget);
+	poseKey.appendValue(solve_threshold);
+	poseKey.appendValue(solve_iterationCount);
+
+	// the self-collision settings change the solved pose.
+	poseKey.appendValue(selfCollision_enabled);
+	if (selfCollision_enabled)
+	{
+		poseKey.appendValue(selfCollision_chainRadius);
+		poseKey.appendValue(PosableCharacter->selfCollision_capsules.Num());
+		for (const FIKCapsuleProxy& capsule : PosableCharacter->selfCollision_capsules)
+		{
+			poseKey.appendValue(capsule.startBoneName);
+			poseKey.appendValue(capsule.endBoneName);
+			poseKey.appendValue(capsule.radius);
+		}
+	}
+
+	if (poseSharing->joinGroup(poseKey, TEXT("IK CCD")))
+	{
+		// group leader: solve and store the bone space rotations of the chain.
+		lastSolveResult = Solve(PosableMesh, targetPosition, boneNames, solve_threshold, solve_iterationCount);
+		FPoseSharingPose* sharedPose = poseSharing->findGroupPose(poseKey);
+		for (int32 boneIndex : boneIndices)
+		{
+			sharedPose->rotations.Add(PosableMesh->BoneSpaceTransforms.IsValidIndex(boneIndex)
+					? PosableMesh->BoneSpaceTransforms[boneIndex].GetRotation()
+					: FQuat::Identity);
+		}
+		sharedPose->outcome = static_cast<uint8>(lastSolveResult.outcome);
+		sharedPose->iterations = lastSolveResult.iterations;
+		return;
+	}
+
+	// group member: fan the leader pose out.
+	const FPoseSharingPose* sharedPose = poseSharing->findGroupPose(poseKey);
+	if (!sharedPose || sharedPose->rotations.Num() != boneIndices.Num())
+	{
+		poseSharing->noteExtraSolve(poseKey);
+		lastSolveResult = Solve(PosableMesh, targetPosition, boneNames, solve_threshold, solve_iterationCount);
+		return;
+	}
+	for (int32 b = 0; b < boneIndices.Num(); b++)
+	{
+		if (PosableMesh->BoneSpaceTransforms.IsValidIndex(boneIndices[b]))
+		{
+			PosableMesh->BoneSpaceTransforms[boneIndices[b]].SetRotation(sharedPose->rotations[b]);
+		}
+	}
+	PosableMesh->MarkRefreshTransformDirty();
+
+	// the result of the leader, with the error measured against the own target of the member (it differs within the tolerance).
+	lastSolveResult.outcome = static_cast<EIK_CCDOutcome>(sharedPose->outcome);
+	lastSolveResult.iterations = sharedPose->iterations;
+	lastSolveResult.error = FVector::Dist(PosableMesh->GetBoneLocationByName(FName(boneNames[0]), EBoneSpaces::WorldSpace), targetPosition);
 }
 
 // Called when the game starts
@@ -54,10 +283,57 @@ void UIK_CCD::BeginPlay()
 
 	if (PosableCharacter) {
 		PosableMesh = PosableCharacter->posableMeshComponent_reference;
+		// the character builds its procedural pose key on its tick, the shared solves are keyed on it.
+		AddTickPrerequisiteActor(PosableCharacter);
 	}
 	else {
 		UE_LOG(LogTemp, Warning, TEXT("CCD: Poseable character not found"));
 	}
+
+	if (targetStreamId != INDEX_NONE) {
+		targetStream = GetWorld()->GetSubsystem<UIKTargetStreamSubsystem>();
+	}
+}
+
+void UIK_CCD::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	// append the recorded workload of the chain as a new session, the IKAutoTune commandlet replays it.
+	if (autoTune_recordedTargets.Num() > 0 && PosableMesh && PosableMesh->GetSkinnedAsset())
+	{
+		const FString workloadPath = FPaths::ProjectSavedDir() / TEXT("IKAutoTune")
+				/ getChainKey(PosableMesh->GetSkinnedAsset(), chain_boneNames) + TEXT(".csv");
+		FString workload = FString(autoTuneSessionSeparator) + TEXT("\n");
+		for (const FVector& target : autoTune_recordedTargets)
+		{
+			workload += FString::Printf(TEXT("%f,%f,%f\n"), target.X, target.Y, target.Z);
+		}
+		FFileHelper::SaveStringToFile(workload, *workloadPath, FFileHelper::EEncodingOptions::AutoDetect,
+				&IFileManager::Get(), FILEWRITE_Append);
+		autoTune_recordedTargets.Empty();
+	}
+	Super::EndPlay(EndPlayReason);
+}
+
+FString UIK_CCD::getChainKey(const USkinnedAsset* skinnedAsset, const TArray<FString>& boneNames)
+{
+	return (skinnedAsset ? skinnedAsset->GetName() : FString(TEXT("None"))) + TEXT(".") + FString::Join(boneNames, TEXT("."));
+}
+
+void UIK_CCD::applyTunedSettings()
+{
+	autoTune_hasAppliedSettings = true;
+	if (!autoTune_useTunedSettings || !GConfig)
+		return;
+
+	// written by the IKAutoTune commandlet as <chain key>=(threshold=...,iterationCount=...)
+	FString tunedSettings;
+	if (!GConfig->GetString(autoTuneConfigSection, *getChainKey(PosableMesh->GetSkinnedAsset(), chain_boneNames), tunedSettings, GGameIni))
+		return;
+
+	FParse::Value(*tunedSettings, TEXT("threshold="), solve_threshold);
+	FParse::Value(*tunedSettings, TEXT("iterationCount="), solve_iterationCount);
+	UE_LOG(LogTemp, Log, TEXT("%s: tuned IK settings applied (threshold %g, %d iterations)"),
+			*GetPathName(), solve_threshold, solve_iterationCount);
 }
 
 // Called every frame
@@ -65,11 +341,52 @@ void UIK_CCD::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponen
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
-	TArray<FString> boneNames = {
-			TEXT("hand_l"),
-			TEXT("lowerarm_l"),
-			TEXT("upperarm_l"),
-	};
+	// the skeletal mesh is streamed in asynchronously, nothing to solve until it is resident.
+	if (!PosableCharacter || !PosableCharacter->isPosableMeshReady())
+		return;
+
+	if (!autoTune_hasAppliedSettings)
+		applyTunedSettings();
+
+	FVector targetPosition;
+	if (!getTargetPosition(targetPosition))
+		return;
+
+	if (autoTune_recordTargets && chain_boneNames.Num() > 0 && autoTune_recordedTargets.Num() < autoTune_maxRecordedTargets)
+	{
+		const FVector target_componentSpace = PosableMesh->GetComponentTransform().InverseTransformPosition(targetPosition);
+		autoTune_recordedTargets.Add(target_componentSpace
+				- PosableMesh->GetBoneLocationByName(FName(chain_boneNames.Last()), EBoneSpaces::ComponentSpace));
+	}
+
+	if (UPoseSharingSubsystem::isEnabled())
+		solveShared(chain_boneNames, targetPosition);
+	else
+		lastSolveResult = Solve(PosableMesh, targetPosition, chain_boneNames, solve_threshold, solve_iterationCount);
+}
+
+bool UIK_CCD::getTargetPosition(FVector& outTargetPosition)
+{
+	// streamed targets are read in place from the shared memory frame.
+	if (targetStreamId != INDEX_NONE && targetStream && targetStream->isConnected())
+	{
+		if (targetStream->getTargetPosition(targetStreamId, streamedTarget_lastPosition))
+			streamedTarget_hasPosition = true;
+
+		// when the frame has no target or was overwritten while read, hold the last streamed one rather than snapping to the actor.
+		if (streamedTarget_hasPosition)
+		{
+			outTargetPosition = streamedTarget_lastPosition;
+			return true;
+		}
+	}
+	else
+	{
+		streamedTarget_hasPosition = false;
+	}
 
-	Solve(PosableMesh, targetActor_reference->GetActorLocation(), boneNames);
+	if (!targetActor_reference)
+		return false;
+	outTargetPosition = targetActor_reference->GetActorLocation();
+	return true;
 }
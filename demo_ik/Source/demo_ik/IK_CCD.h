@@ -6,9 +6,68 @@
 #include "Components/ActorComponent.h"
 #include "APosableCharacter.h"
 #include "Components/PoseableMeshComponent.h" 
+#include "IKSelfCollision.h"
 
 #include "IK_CCD.generated.h"
 
+class USkinnedAsset;
+
+/**
+ * how a CCD solve ended.
+ */
+UENUM(BlueprintType)
+enum class EIK_CCDOutcome : uint8
+{
+	// the end effector is within the threshold of the target.
+	Reached,
+	// the iteration budget ran out before the end effector got within the threshold.
+	NotConverged,
+	// the target is beyond the chain length: it was projected on the reach sphere and the chain straightened in one pass.
+	// (a target within the threshold of the reach sphere is straightened too, and reported as Reached.)
+	OutOfReach,
+	// the target is inside the sphere the chain cannot fold into: it was projected on that sphere before solving.
+	TooClose
+};
+
+/**
+ * the result of a CCD solve.
+ */
+USTRUCT(BlueprintType)
+struct FIK_CCDResult
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "IK")
+	EIK_CCDOutcome outcome = EIK_CCDOutcome::NotConverged;
+
+	/**
+	* the number of iterations run (1 for the out-of-reach pass).
+	**/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "IK")
+	int32 iterations = 0;
+
+	/**
+	* the distance between the end effector and the (unprojected) target after the solve.
+	**/
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "IK")
+	float error = 0.0f;
+};
+
+/**
+ * the reach of a chain, precomputed from its segment lengths in component space.
+ * the chain has no joint limits, so its reachable volume is the shell between innerRadius and totalLength.
+ */
+struct FIK_CCDReachData
+{
+	// the skeleton and chain the data was computed for.
+	const USkinnedAsset* skinnedAsset = nullptr;
+	TArray<FString> boneNames;
+	// the sum of the segment lengths: the radius of the reach sphere around the chain root.
+	float totalLength = 0.0f;
+	// the radius of the sphere around the chain root that the chain cannot fold into.
+	float innerRadius = 0.0f;
+};
+
 
 UCLASS( ClassGroup=(Custom), meta=(BlueprintSpawnableComponent) )
 class DEMO_IK_API UIK_CCD : public UActorComponent
@@ -22,18 +81,174 @@ public:
 	UPROPERTY(EditAnywhere)
 	class AActor* targetActor_reference;
 
+	/**
+	* the ID of the externally streamed target driving this chain (see UIKTargetStreamSubsystem).
+	* INDEX_NONE to follow targetActor_reference, which is also used until the stream has sent a target and while it is disconnected.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK target stream")
+	int32 targetStreamId = INDEX_NONE;
+
 	AAPosableCharacter* PosableCharacter;
 	UPoseableMeshComponent* PosableMesh;
 
+	/**
+	* the chain, from the end effector to the chain root.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK")
+	TArray<FString> chain_boneNames = { TEXT("hand_l"), TEXT("lowerarm_l"), TEXT("upperarm_l") };
+
+	/**
+	* the distance to the target under which the solve stops.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK")
+	float solve_threshold = 0.01f;
+
+	/**
+	* the maximum number of iterations over the chain.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK")
+	int32 solve_iterationCount = 10;
+
+	/**
+	* replace solve_threshold and solve_iterationCount by the settings measured by the IKAutoTune commandlet for this chain, if any.
+	* off by default, so the values set on the instance are not overridden by the config without notice.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK auto-tune")
+	bool autoTune_useTunedSettings = false;
+
+	/**
+	* record the chain-root-relative targets, appended on EndPlay to Saved/IKAutoTune/<chain key>.csv as a tuning workload.
+	* each play session starts with a separator line, so the replay does not warm-start across sessions.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK auto-tune")
+	bool autoTune_recordTargets = false;
+
+	/**
+	* the maximum number of targets recorded per play session, the recording stops once it is reached.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK auto-tune", meta = (ClampMin = "1"))
+	int32 autoTune_maxRecordedTargets = 4096;
+
+	/**
+	* the result of the last solve run by this component.
+	**/
+	UPROPERTY(VisibleAnywhere, Category = "IK")
+	FIK_CCDResult lastSolveResult;
+
+	/**
+	* push the chain out of the capsule proxies of the character (selfCollision_capsules) after each iteration.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK self-collision")
+	bool selfCollision_enabled = false;
+
+	/**
+	* the thickness of the chain segments tested against the capsule proxies.
+	**/
+	UPROPERTY(EditAnywhere, Category = "IK self-collision")
+	float selfCollision_chainRadius = 5.0f;
+
 
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
 
+	// Called when the component is removed from the world
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
 public:	
 	// Called every frame
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
 public:
-	virtual void Solve(UPoseableMeshComponent* skeleton, const FVector &targetPosition, TArray<FString> &boneVectors, float threshold = 0.01, int iterationCount = 10);
+	virtual FIK_CCDResult Solve(UPoseableMeshComponent* skeleton, const FVector &targetPosition, TArray<FString> &boneVectors, float threshold = 0.01, int iterationCount = 10);
+
+	/**
+	* get the reach data of a chain, computed on first use and cached until the skeleton or the chain changes.
+	* @param skeleton: the posable mesh the chain belongs to.
+	* @param boneNames: the chain, from the end effector to the chain root.
+	* @return: the reach data of the chain.
+	**/
+	const FIK_CCDReachData& getReachData(UPoseableMeshComponent* skeleton, const TArray<FString>& boneNames);
+
+	/**
+	* the key of a chain in the auto-tune config section and workload files.
+	* @param skinnedAsset: the skeleton of the chain.
+	* @param boneNames: the chain, from the end effector to the chain root.
+	* @return: <asset name>.<bone>.<bone>...
+	**/
+	static FString getChainKey(const USkinnedAsset* skinnedAsset, const TArray<FString>& boneNames);
+
+	/**
+	* the config section (game ini) the IKAutoTune commandlet writes the tuned settings to.
+	**/
+	static const TCHAR* autoTuneConfigSection;
+
+	/**
+	* the line starting each recorded session in the workload files.
+	**/
+	static const TCHAR* autoTuneSessionSeparator;
+
+protected:
+	/**
+	* rotate the chain, from the root to the end effector, so that every segment points along a direction.
+	* @param skeleton: the posable mesh the chain belongs to.
+	* @param boneNames: the chain, from the end effector to the chain root.
+	* @param direction: the world space direction to straighten the chain along.
+	**/
+	void straightenChain(UPoseableMeshComponent* skeleton, const TArray<FString>& boneNames, const FVector& direction);
+
+	/**
+	* push each segment of the chain, from the root to the end effector, out of the capsule proxies.
+	* @param skeleton: the posable mesh the chain belongs to.
+	* @param boneNames: the chain, from the end effector to the chain root.
+	**/
+	void resolveSelfCollision(UPoseableMeshComponent* skeleton, const TArray<FString>& boneNames);
+
+	/**
+	* read the tuned threshold and iteration count of the chain from the game config, once the mesh is resident.
+	**/
+	void applyTunedSettings();
+
+	/**
+	* the chain-root-relative targets recorded for the auto-tuner (autoTune_recordTargets).
+	**/
+	TArray<FVector> autoTune_recordedTargets;
+	bool autoTune_hasAppliedSettings = false;
+
+	/**
+	* get the target of the chain, from the target stream if one is set, from the target actor otherwise.
+	* @param outTargetPosition: the target in world space.
+	* @return: false if there is no target this frame.
+	**/
+	bool getTargetPosition(FVector& outTargetPosition);
+
+	/**
+	* the last valid target read from the stream, held while the stream frames miss it.
+	**/
+	FVector streamedTarget_lastPosition = FVector::ZeroVector;
+	bool streamedTarget_hasPosition = false;
+
+	/**
+	* the target stream provider of the world, cached on BeginPlay.
+	**/
+	UPROPERTY(Transient)
+	class UIKTargetStreamSubsystem* targetStream = nullptr;
+
+	/**
+	* the cached reach data of the last solved chain.
+	**/
+	FIK_CCDReachData reachData;
+
+	/**
+	* the packed capsule proxies of the skeleton, without the capsules attached to the solved chain.
+	**/
+	FIKCapsuleProxySet selfCollision_proxies;
+
+	/**
+	* solve through the pose sharing subsystem: characters with the same skeleton, procedural pose and quantized
+	* chain-root-relative target share a single solve per frame.
+	* @param boneNames: the chain, from the end effector to the chain root.
+	* @param targetPosition: the target in world space.
+	**/
+	void solveShared(TArray<FString>& boneNames, const FVector& targetPosition);
 };
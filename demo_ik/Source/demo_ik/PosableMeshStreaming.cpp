@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PosableMeshStreaming.h"
+#include "APosableCharacter.h"
+#include "Engine/AssetManager.h"
+#include "Engine/StreamableManager.h"
+
+
+void UPosableMeshStreamingSubsystem::Deinitialize()
+{
+	// unpin the meshes, and drop the loads still in flight with their callbacks.
+	for (TPair<FSoftObjectPath, TSharedPtr<FStreamableHandle>>& meshHandle : sharedMeshHandles)
+	{
+		if (!meshHandle.Value.IsValid())
+		{
+			continue;
+		}
+		if (meshHandle.Value->IsLoadingInProgress())
+		{
+			meshHandle.Value->CancelHandle();
+		}
+		else
+		{
+			meshHandle.Value->ReleaseHandle();
+		}
+	}
+	sharedMeshHandles.Empty();
+	pendingMeshCharacters.Empty();
+	Super::Deinitialize();
+}
+
+bool UPosableMeshStreamingSubsystem::requestMesh(AAPosableCharacter* character)
+{
+	const FSoftObjectPath meshPath = character->default_skeletalMesh_reference.ToSoftObjectPath();
+	pendingMeshCharacters.FindOrAdd(meshPath).Add(character);
+
+	TSharedPtr<FStreamableHandle>& handle = sharedMeshHandles.FindOrAdd(meshPath);
+	if (handle.IsValid() && handle->IsLoadingInProgress())
+	{
+		// another character already requested this mesh, wait for the same load.
+		return true;
+	}
+
+	handle = UAssetManager::GetStreamableManager().RequestAsyncLoad(
+			meshPath,
+			FStreamableDelegate::CreateUObject(this, &UPosableMeshStreamingSubsystem::onMeshLoaded, meshPath),
+			FStreamableManager::AsyncLoadHighPriority);
+
+	if (!handle.IsValid())
+	{
+		pendingMeshCharacters.Remove(meshPath);
+		sharedMeshHandles.Remove(meshPath);
+		return false;
+	}
+	return true;
+}
+
+void UPosableMeshStreamingSubsystem::onMeshLoaded(FSoftObjectPath meshPath)
+{
+	TArray<TWeakObjectPtr<AAPosableCharacter>> waitingCharacters;
+	pendingMeshCharacters.RemoveAndCopyValue(meshPath, waitingCharacters);
+	for (const TWeakObjectPtr<AAPosableCharacter>& character : waitingCharacters)
+	{
+		if (character.IsValid() && character->HasActorBegunPlay() && !character->isPosableMeshReady())
+		{
+			character->onPosableMeshLoaded();
+		}
+	}
+}
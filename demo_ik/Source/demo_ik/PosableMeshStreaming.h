@@ -0,0 +1,49 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/GameInstanceSubsystem.h"
+#include "PosableMeshStreaming.generated.h"
+
+class AAPosableCharacter;
+struct FStreamableHandle;
+
+
+/**
+ * streams in the skeletal meshes of the posable characters.
+ * there is one load per mesh, shared by every character using it. the handle keeps the mesh resident for the
+ * lifetime of the game instance, and is released when the game instance shuts down (end of the game or PIE session).
+ */
+UCLASS()
+class DEMO_IK_API UPosableMeshStreamingSubsystem : public UGameInstanceSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	/**
+	* request the skeletal mesh of a character. the character is notified with onPosableMeshLoaded once the mesh is resident.
+	* @param character: the character waiting for its default skeletal mesh.
+	* @return: false if the load could not be requested.
+	**/
+	bool requestMesh(AAPosableCharacter* character);
+
+protected:
+	/**
+	* notify the characters waiting for a mesh that it is resident.
+	* @param meshPath: the loaded mesh.
+	**/
+	void onMeshLoaded(FSoftObjectPath meshPath);
+
+	/**
+	* one streamable handle per skeletal mesh, shared by every posable character using it (keeps the mesh resident).
+	**/
+	TMap<FSoftObjectPath, TSharedPtr<FStreamableHandle>> sharedMeshHandles;
+
+	/**
+	* the characters waiting for each skeletal mesh to be loaded.
+	**/
+	TMap<FSoftObjectPath, TArray<TWeakObjectPtr<AAPosableCharacter>>> pendingMeshCharacters;
+};
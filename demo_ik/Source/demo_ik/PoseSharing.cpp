@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PoseSharing.h"
+#include "HAL/IConsoleManager.h"
+#include "Engine/World.h"
+
+
+static TAutoConsoleVariable<bool> CVarPoseSharingEnabled(
+	TEXT("ik.PoseSharing"),
+	false,
+	TEXT("solve identical procedural and IK poses once per frame and share them across characters."));
+
+static TAutoConsoleVariable<float> CVarPoseSharingTolerance(
+	TEXT("ik.PoseSharing.Tolerance"),
+	1.0f,
+	TEXT("quantization step (cm) of the root-relative IK targets: targets closer than this share a pose."));
+
+static FAutoConsoleCommandWithWorld PoseSharingStatsCommand(
+	TEXT("ik.PoseSharing.Stats"),
+	TEXT("log the pose sharing groups of the last frame."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* world)
+	{
+		if (const UPoseSharingSubsystem* poseSharing = world ? world->GetSubsystem<UPoseSharingSubsystem>() : nullptr)
+		{
+			poseSharing->logStats();
+		}
+	}));
+
+
+bool UPoseSharingSubsystem::isEnabled()
+{
+	return CVarPoseSharingEnabled.GetValueOnGameThread();
+}
+
+float UPoseSharingSubsystem::getTolerance()
+{
+	return FMath::Max(CVarPoseSharingTolerance.GetValueOnGameThread(), UE_KINDA_SMALL_NUMBER);
+}
+
+FIntVector UPoseSharingSubsystem::quantizeLocation(const FVector& rootRelativeLocation)
+{
+	const FVector quantized = rootRelativeLocation / getTolerance();
+	return FIntVector(FMath::RoundToInt(quantized.X), FMath::RoundToInt(quantized.Y), FMath::RoundToInt(quantized.Z));
+}
+
+void UPoseSharingSubsystem::beginFrameIfNeeded()
+{
+	if (currentFrame == GFrameCounter)
+	{
+		return;
+	}
+	currentFrame = GFrameCounter;
+	lastFrameStats = MoveTemp(currentStats);
+	currentStats.Reset();
+	sharedPoses.Reset();
+}
+
+bool UPoseSharingSubsystem::joinGroup(const FPoseSharingKey& key, const TCHAR* label)
+{
+	beginFrameIfNeeded();
+
+	FPoseSharingGroupStats& stats = currentStats.FindOrAdd(key);
+	const bool isLeader = stats.members == 0;
+	if (isLeader)
+	{
+		stats.label = label;
+		stats.solves++;
+		sharedPoses.FindOrAdd(key) = FPoseSharingPose();
+	}
+	stats.members++;
+	return isLeader;
+}
+
+FPoseSharingPose* UPoseSharingSubsystem::findGroupPose(const FPoseSharingKey& key)
+{
+	beginFrameIfNeeded();
+	return sharedPoses.Find(key);
+}
+
+void UPoseSharingSubsystem::noteExtraSolve(const FPoseSharingKey& key)
+{
+	beginFrameIfNeeded();
+	if (FPoseSharingGroupStats* stats = currentStats.Find(key))
+	{
+		stats->solves++;
+	}
+}
+
+void UPoseSharingSubsystem::logStats() const
+{
+	int32 members = 0;
+	int32 solves = 0;
+	for (const TPair<FPoseSharingKey, FPoseSharingGroupStats>& group : lastFrameStats)
+	{
+		UE_LOG(LogTemp, Log, TEXT("pose sharing group %08x (%s): %d members, %d solves"),
+				GetTypeHash(group.Key), *group.Value.label, group.Value.members, group.Value.solves);
+		members += group.Value.members;
+		solves += group.Value.solves;
+	}
+	UE_LOG(LogTemp, Log, TEXT("pose sharing: %d groups, %d members, %d solves"), lastFrameStats.Num(), members, solves);
+}
@@ -0,0 +1,162 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include <type_traits>
+#include "PoseSharing.generated.h"
+
+
+/**
+ * the identity of a pose sharing group: the raw bytes of everything the pose depends on.
+ * groups are told apart by comparing the bytes, the hash only selects the bucket, so two different keys never share a pose.
+ */
+struct FPoseSharingKey
+{
+	/**
+	* append raw bytes to the key.
+	* @param data: the bytes to append.
+	* @param size: the number of bytes.
+	**/
+	void append(const void* data, int32 size)
+	{
+		bytes.Append(static_cast<const uint8*>(data), size);
+		hash = FCrc::MemCrc32(data, size, hash);
+	}
+
+	/**
+	* append a value to the key. the type must have no padding, so equal values have equal bytes.
+	* @param value: the value to append.
+	**/
+	template <typename T>
+	void appendValue(const T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "only plain values can be appended to a pose sharing key");
+		append(&value, sizeof(T));
+	}
+
+	/**
+	* append another key, e.g. the procedural pose an IK solve starts from.
+	* @param other: the key to append.
+	**/
+	void appendKey(const FPoseSharingKey& other)
+	{
+		// prefixed with its size, so the bytes that follow cannot be mistaken for part of it.
+		appendValue(other.bytes.Num());
+		append(other.bytes.GetData(), other.bytes.Num());
+	}
+
+	void reset()
+	{
+		bytes.Reset();
+		hash = 0;
+	}
+
+	bool operator==(const FPoseSharingKey& other) const
+	{
+		return hash == other.hash && bytes == other.bytes;
+	}
+
+	friend uint32 GetTypeHash(const FPoseSharingKey& key)
+	{
+		return key.hash;
+	}
+
+	TArray<uint8> bytes;
+	uint32 hash = 0;
+};
+
+/**
+ * the pose stored by the leader of a pose sharing group for its members.
+ */
+struct FPoseSharingPose
+{
+	// the bone space rotations, in the order the solver stored them.
+	TArray<FQuat> rotations;
+	// the outcome code of the leader solve (solver specific, e.g. EIK_CCDOutcome) and the iterations it ran.
+	uint8 outcome = 0;
+	int32 iterations = 0;
+};
+
+/**
+ * the per-frame statistics of one pose sharing group.
+ */
+struct FPoseSharingGroupStats
+{
+	// what the group shares (solver and skeleton), for display.
+	FString label;
+	// the number of characters that requested this pose during the frame.
+	int32 members = 0;
+	// the number of solves run for this pose during the frame: the leader's, plus the member fallbacks (see noteExtraSolve).
+	int32 solves = 0;
+};
+
+/**
+ * deduplicates identical procedural and IK solves across the characters of a crowd.
+ * callers build a key from (skeleton, animation params, quantized root-relative target): the first caller of a frame
+ * becomes the group leader, solves and stores the resulting bone space rotations, and every other member copies them.
+ * enabled with ik.PoseSharing, the target quantization step is ik.PoseSharing.Tolerance (in cm),
+ * and ik.PoseSharing.Stats logs the groups of the last frame.
+ */
+UCLASS()
+class DEMO_IK_API UPoseSharingSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/**
+	* @return: true if pose sharing is enabled (ik.PoseSharing).
+	**/
+	static bool isEnabled();
+
+	/**
+	* @return: the quantization step applied to root-relative targets, in cm (ik.PoseSharing.Tolerance).
+	**/
+	static float getTolerance();
+
+	/**
+	* quantize a root-relative location with the current tolerance, to be appended to a group key.
+	* @param rootRelativeLocation: the location relative to the chain root, in component space.
+	* @return: the quantized location.
+	**/
+	static FIntVector quantizeLocation(const FVector& rootRelativeLocation);
+
+	/**
+	* join the group of a key for the current frame.
+	* @param key: the group key.
+	* @param label: the group description, used by the stats.
+	* @return: true if the caller is the first member of the frame and has to solve and store the pose.
+	**/
+	bool joinGroup(const FPoseSharingKey& key, const TCHAR* label);
+
+	/**
+	* find the shared pose of a group joined during the current frame.
+	* the pointer is only stable until the next call to joinGroup.
+	* @param key: the group key.
+	* @return: the shared pose of the group (filled by the leader), nullptr if the group was not joined.
+	**/
+	FPoseSharingPose* findGroupPose(const FPoseSharingKey& key);
+
+	/**
+	* count a solve run by a member of a group that could not use the shared pose.
+	* @param key: the group key.
+	**/
+	void noteExtraSolve(const FPoseSharingKey& key);
+
+	/**
+	* log the groups of the last complete frame.
+	**/
+	void logStats() const;
+
+protected:
+	/**
+	* drop the poses of the previous frame when a new frame starts.
+	**/
+	void beginFrameIfNeeded();
+
+	TMap<FPoseSharingKey, FPoseSharingPose> sharedPoses;
+	TMap<FPoseSharingKey, FPoseSharingGroupStats> currentStats;
+	TMap<FPoseSharingKey, FPoseSharingGroupStats> lastFrameStats;
+	uint64 currentFrame = 0;
+};
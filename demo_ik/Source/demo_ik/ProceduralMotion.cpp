@@ -0,0 +1,318 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ProceduralMotion.h"
+#include "APosableCharacter.h"
+#include "PoseSharing.h"
+#include "Async/ParallelFor.h"
+#include "Components/PoseableMeshComponent.h"
+#include "Engine/SkinnedAsset.h"
+
+
+void UProceduralMotionSubsystem::registerCharacter(AAPosableCharacter* character)
+{
+	if (!character)
+	{
+		return;
+	}
+	registeredCharacters.AddUnique(character);
+	character->proceduralMotion_staticPoseKey.reset();
+	entriesDirty = true;
+}
+
+void UProceduralMotionSubsystem::unregisterCharacter(AAPosableCharacter* character)
+{
+	registeredCharacters.Remove(character);
+	entriesDirty = true;
+}
+
+void UProceduralMotionSubsystem::markEntriesDirty()
+{
+	// the resolved entries no longer match the layers, the characters stop sharing until they are rebuilt.
+	for (const TWeakObjectPtr<AAPosableCharacter>& character : registeredCharacters)
+	{
+		if (character.IsValid())
+		{
+			character->proceduralMotion_staticPoseKey.reset();
+		}
+	}
+	entriesDirty = true;
+}
+
+void UProceduralMotionSubsystem::rebuildEntries()
+{
+	characterSlots.Reset();
+	entries.Reset();
+	registeredCharacters.RemoveAll([](const TWeakObjectPtr<AAPosableCharacter>& character) { return !character.IsValid(); });
+
+	for (const TWeakObjectPtr<AAPosableCharacter>& character : registeredCharacters)
+	{
+		UPoseableMeshComponent* mesh = character->posableMeshComponent_reference;
+		character->proceduralMotion_staticPoseKey.reset();
+		const TArray<FTransform>& basePose = character->getInitialBoneSpaceTransforms();
+		if (!mesh || basePose.Num() != mesh->GetNumBones())
+		{
+			UE_LOG(LogTemp, Warning, TEXT("procedural motion: %s has no initial pose, skipped"), *character->GetName());
+			continue;
+		}
+
+		FCharacterSlot slot;
+		slot.character = character;
+		slot.firstEntry = entries.Num();
+		slot.isShareable = true;
+
+		// resolve the bone names once, so the tick never looks them up.
+		for (int32 layerIndex = 0; layerIndex < character->proceduralMotion_layers.Num(); ++layerIndex)
+		{
+			for (const FProceduralMotionEntry& entry : character->proceduralMotion_layers[layerIndex].entries)
+			{
+				const int32 boneIndex = mesh->GetBoneIndex(entry.boneName);
+				if (boneIndex == INDEX_NONE)
+				{
+					UE_LOG(LogTemp, Warning, TEXT("bone: %s not found!"), *entry.boneName.ToString());
+					continue;
+				}
+
+				// zeroed so the padding is deterministic for the pose key bytes.
+				FResolvedEntry& resolved = entries.AddZeroed_GetRef();
+				resolved.boneIndex = boneIndex;
+				resolved.layerIndex = layerIndex;
+				resolved.generator = entry.generator;
+				resolved.speed = entry.speed;
+				resolved.phase = entry.phase;
+				resolved.amplitude = entry.amplitude;
+				resolved.axis = entry.axis;
+				resolved.baseRotation = basePose[boneIndex].GetRotation();
+				resolved.baseRotator = resolved.baseRotation.Rotator();
+				resolved.targetRotation = entry.targetRotation.Quaternion();
+				resolved.lookAtTarget = entry.lookAtTarget;
+				resolved.lookAtAxis = entry.lookAtAxis.GetSafeNormal();
+				slot.isShareable &= entry.generator != EProceduralMotionGenerator::LookAt;
+			}
+		}
+
+		slot.numEntries = entries.Num() - slot.firstEntry;
+
+		// the character completes the key with the playing state of its layers every tick.
+		FPoseSharingKey& staticPoseKey = character->proceduralMotion_staticPoseKey;
+		staticPoseKey.appendValue(mesh->GetSkinnedAsset());
+		staticPoseKey.appendValue(slot.numEntries);
+		staticPoseKey.append(entries.GetData() + slot.firstEntry, slot.numEntries * sizeof(FResolvedEntry));
+		if (!slot.isShareable)
+		{
+			// evaluated on its own, and its pose is unique for the IK keys built on top of it.
+			staticPoseKey.appendValue(character.Get());
+		}
+		if (slot.numEntries > 0)
+		{
+			characterSlots.Add(slot);
+		}
+	}
+	entriesDirty = false;
+}
+
+bool UProceduralMotionSubsystem::evaluateSlot(const FCharacterSlot& slot, const AAPosableCharacter* character, UPoseableMeshComponent* mesh, float currentTime) const
+{
+	const TArray<FProceduralMotionLayer>& layers = character->proceduralMotion_layers;
+	TArray<FTransform>& boneSpaceTransforms = mesh->BoneSpaceTransforms;
+	bool hasWritten = false;
+
+	for (int32 e = slot.firstEntry; e < slot.firstEntry + slot.numEntries; ++e)
+	{
+		const FResolvedEntry& entry = entries[e];
+		if (!layers.IsValidIndex(entry.layerIndex) || !layers[entry.layerIndex].isPlaying)
+		{
+			continue;
+		}
+
+		FQuat newRotation;
+		switch (entry.generator)
+		{
+		case EProceduralMotionGenerator::Oscillator:
+		{
+			const float angleOffset = FMath::Sin(entry.speed * currentTime + entry.phase) * entry.amplitude;
+			newRotation = (entry.baseRotator + entry.axis * angleOffset).Quaternion();
+			break;
+		}
+		case EProceduralMotionGenerator::SlerpTween:
+		{
+			const float progress = 0.5f * FMath::Sin(entry.speed * currentTime + entry.phase) + 0.5f;
+			newRotation = FQuat::Slerp(entry.baseRotation, entry.targetRotation, progress);
+			break;
+		}
+		case EProceduralMotionGenerator::Noise:
+		{
+			const float angleOffset = FMath::PerlinNoise1D(entry.speed * currentTime + entry.phase) * entry.amplitude;
+			newRotation = (entry.baseRotator + entry.axis * angleOffset).Quaternion();
+			break;
+		}
+		case EProceduralMotionGenerator::LookAt:
+		{
+			// accumulate the parent transform in component space from the current bone space pose.
+			const FReferenceSkeleton& refSkeleton = mesh->GetSkinnedAsset()->GetRefSkeleton();
+			FTransform parent_componentSpaceTransform = FTransform::Identity;
+			for (int32 p = refSkeleton.GetParentIndex(entry.boneIndex); p != INDEX_NONE; p = refSkeleton.GetParentIndex(p))
+			{
+				parent_componentSpaceTransform = parent_componentSpaceTransform * boneSpaceTransforms[p];
+			}
+
+			// aim the bone axis at the target, expressed relative to the parent.
+			const FVector targetDirection = (parent_componentSpaceTransform.InverseTransformPosition(entry.lookAtTarget)
+				- boneSpaceTransforms[entry.boneIndex].GetTranslation()).GetSafeNormal();
+			if (targetDirection.IsNearlyZero())
+			{
+				continue;
+			}
+			const FVector aimDirection = entry.baseRotation.RotateVector(entry.lookAtAxis);
+			const FQuat aimedRotation = FQuat::FindBetweenNormals(aimDirection, targetDirection) * entry.baseRotation;
+			newRotation = FQuat::Slerp(entry.baseRotation, aimedRotation, FMath::Clamp(entry.amplitude, 0.0f, 1.0f));
+			break;
+		}
+		default:
+			continue;
+		}
+
+		boneSpaceTransforms[entry.boneIndex].SetRotation(newRotation);
+		hasWritten = true;
+	}
+	return hasWritten;
+}
+
+bool UProceduralMotionSubsystem::copySharedSlot(const FCharacterSlot& slot, const AAPosableCharacter* character, UPoseableMeshComponent* mesh, const TArray<FQuat>& sharedRotations) const
+{
+	if (sharedRotations.Num() != slot.numEntries)
+	{
+		return false;
+	}
+
+	const TArray<FProceduralMotionLayer>& layers = character->proceduralMotion_layers;
+	TArray<FTransform>& boneSpaceTransforms = mesh->BoneSpaceTransforms;
+	bool hasWritten = false;
+
+	for (int32 i = 0; i < slot.numEntries; ++i)
+	{
+		const FResolvedEntry& entry = entries[slot.firstEntry + i];
+		if (layers.IsValidIndex(entry.layerIndex) && layers[entry.layerIndex].isPlaying)
+		{
+			boneSpaceTransforms[entry.boneIndex].SetRotation(sharedRotations[i]);
+			hasWritten = true;
+		}
+	}
+	return hasWritten;
+}
+
+void UProceduralMotionSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (entriesDirty)
+	{
+		rebuildEntries();
+	}
+	if (characterSlots.Num() == 0)
+	{
+		return;
+	}
+
+	// gather the raw pointers on the game thread, the workers only touch plain data.
+	TArray<AAPosableCharacter*> slotCharacters;
+	TArray<UPoseableMeshComponent*> slotMeshes;
+	slotCharacters.SetNumZeroed(characterSlots.Num());
+	slotMeshes.SetNumZeroed(characterSlots.Num());
+	for (int32 s = 0; s < characterSlots.Num(); ++s)
+	{
+		AAPosableCharacter* character = characterSlots[s].character.Get();
+		if (character && character->posableMeshComponent_reference && character->posableMeshComponent_reference->GetSkinnedAsset())
+		{
+			slotCharacters[s] = character;
+			slotMeshes[s] = character->posableMeshComponent_reference;
+		}
+	}
+
+	const float currentTime = GetWorld()->GetTimeSeconds();
+	TArray<bool> slotWritten;
+	slotWritten.SetNumZeroed(characterSlots.Num());
+
+	if (!UPoseSharingSubsystem::isEnabled())
+	{
+		ParallelFor(characterSlots.Num(), [&](int32 s)
+		{
+			if (slotMeshes[s])
+			{
+				slotWritten[s] = evaluateSlot(characterSlots[s], slotCharacters[s], slotMeshes[s], currentTime);
+			}
+		});
+	}
+	else
+	{
+		// group the characters by skeleton, entries and playing layers: only the first of each group is evaluated.
+		UPoseSharingSubsystem* poseSharing = GetWorld()->GetSubsystem<UPoseSharingSubsystem>();
+		TArray<FPoseSharingPose*> slotSharedPoses;
+		TArray<bool> slotIsLeader;
+		slotSharedPoses.SetNumZeroed(characterSlots.Num());
+		slotIsLeader.SetNumZeroed(characterSlots.Num());
+		for (int32 s = 0; s < characterSlots.Num(); ++s)
+		{
+			if (!slotMeshes[s])
+			{
+				continue;
+			}
+			// the key was built by the character on its tick, for this frame.
+			if (!characterSlots[s].isShareable)
+			{
+				slotIsLeader[s] = true;
+				continue;
+			}
+			slotIsLeader[s] = poseSharing->joinGroup(slotCharacters[s]->proceduralMotion_poseKey, TEXT("procedural motion"));
+		}
+		// the group poses are looked up once every group exists, so the pointers stay valid.
+		for (int32 s = 0; s < characterSlots.Num(); ++s)
+		{
+			if (slotMeshes[s] && characterSlots[s].isShareable)
+			{
+				slotSharedPoses[s] = poseSharing->findGroupPose(slotCharacters[s]->proceduralMotion_poseKey);
+			}
+		}
+
+		ParallelFor(characterSlots.Num(), [&](int32 s)
+		{
+			if (slotMeshes[s] && slotIsLeader[s])
+			{
+				const FCharacterSlot& slot = characterSlots[s];
+				slotWritten[s] = evaluateSlot(slot, slotCharacters[s], slotMeshes[s], currentTime);
+				if (!slotSharedPoses[s])
+				{
+					return;
+				}
+
+				TArray<FQuat>& sharedRotations = slotSharedPoses[s]->rotations;
+				sharedRotations.SetNumUninitialized(slot.numEntries);
+				for (int32 i = 0; i < slot.numEntries; ++i)
+				{
+					sharedRotations[i] = slotMeshes[s]->BoneSpaceTransforms[entries[slot.firstEntry + i].boneIndex].GetRotation();
+				}
+			}
+		});
+
+		ParallelFor(characterSlots.Num(), [&](int32 s)
+		{
+			if (slotMeshes[s] && !slotIsLeader[s])
+			{
+				slotWritten[s] = copySharedSlot(characterSlots[s], slotCharacters[s], slotMeshes[s], slotSharedPoses[s]->rotations);
+			}
+		});
+	}
+
+	// the render state can only be dirtied from the game thread.
+	for (int32 s = 0; s < characterSlots.Num(); ++s)
+	{
+		if (slotWritten[s])
+		{
+			slotMeshes[s]->MarkRefreshTransformDirty();
+		}
+	}
+}
+
+TStatId UProceduralMotionSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UProceduralMotionSubsystem, STATGROUP_Tickables);
+}
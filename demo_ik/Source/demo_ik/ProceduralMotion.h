@@ -0,0 +1,205 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "PoseSharing.h"
+#include "ProceduralMotion.generated.h"
+
+class AAPosableCharacter;
+class UPoseableMeshComponent;
+
+
+/**
+ * the generators available to drive a bone procedurally.
+ */
+UENUM(BlueprintType)
+enum class EProceduralMotionGenerator : uint8
+{
+	// sine offset added to the base rotation, along the weighted axis.
+	Oscillator,
+	// slerp back and forth between the base rotation and a target rotation.
+	SlerpTween,
+	// perlin noise offset added to the base rotation, along the weighted axis.
+	Noise,
+	// aim the bone towards a component space location.
+	LookAt
+};
+
+/**
+ * one (bone, generator, params) entry of a procedural motion layer.
+ */
+USTRUCT(BlueprintType)
+struct FProceduralMotionEntry
+{
+	GENERATED_BODY()
+
+	/**
+	* the bone driven by this entry.
+	**/
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	FName boneName;
+
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	EProceduralMotionGenerator generator = EProceduralMotionGenerator::Oscillator;
+
+	/**
+	* the angular speed of the generator (radians per second).
+	**/
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	float speed = 1.0f;
+
+	/**
+	* the phase offset of the generator (radians).
+	**/
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	float phase = 0.0f;
+
+	/**
+	* the amplitude in degrees (oscillator, noise) or the blend weight in [0, 1] (look-at).
+	**/
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	float amplitude = 30.0f;
+
+	/**
+	* the per-axis weights of the offset (oscillator, noise).
+	**/
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	FRotator axis = FRotator(0.0f, 1.0f, 0.0f);
+
+	/**
+	* the rotation relative to the parent bone to tween to (slerp tween).
+	**/
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	FRotator targetRotation = FRotator::ZeroRotator;
+
+	/**
+	* the location to aim at, in component space (look-at).
+	**/
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	FVector lookAtTarget = FVector::ZeroVector;
+
+	/**
+	* the bone space axis that is aimed at the target (look-at).
+	**/
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	FVector lookAtAxis = FVector(1.0f, 0.0f, 0.0f);
+};
+
+/**
+ * a named list of procedural motion entries that is played or stopped as a whole.
+ * when several playing layers drive the same bone, the last one wins.
+ */
+USTRUCT(BlueprintType)
+struct FProceduralMotionLayer
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	FName layerName;
+
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	bool isPlaying = false;
+
+	UPROPERTY(EditAnywhere, Category = "procedural motion")
+	TArray<FProceduralMotionEntry> entries;
+};
+
+
+/**
+ * evaluates the procedural motion layers of every registered posable character.
+ * bone names are resolved once on registration into a flat array of bone entries, grouped per character,
+ * which is then evaluated every tick as a tight loop, in parallel across characters.
+ * with pose sharing enabled, characters with the same skeleton, layers and base pose are evaluated once and copied
+ * (except the characters with look-at entries, which depend on their current parent pose).
+ */
+UCLASS()
+class DEMO_IK_API UProceduralMotionSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/**
+	* add a character to the evaluated set. its layers and initial pose are read at the next tick.
+	* @param character: the character to register.
+	**/
+	void registerCharacter(AAPosableCharacter* character);
+
+	/**
+	* remove a character from the evaluated set.
+	* @param character: the character to unregister.
+	**/
+	void unregisterCharacter(AAPosableCharacter* character);
+
+	/**
+	* resolve the layers of all characters again (call after adding or editing layer entries).
+	* their pose is not shared until they are resolved.
+	**/
+	void markEntriesDirty();
+
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+protected:
+	/**
+	* a bone entry resolved against the skeleton of its character.
+	**/
+	struct FResolvedEntry
+	{
+		int32 boneIndex;
+		int32 layerIndex;
+		EProceduralMotionGenerator generator;
+		float speed;
+		float phase;
+		float amplitude;
+		FRotator axis;
+		FRotator baseRotator;
+		FQuat baseRotation;
+		FQuat targetRotation;
+		FVector lookAtTarget;
+		FVector lookAtAxis;
+	};
+
+	/**
+	* the range of the flat entry array that belongs to one character.
+	**/
+	struct FCharacterSlot
+	{
+		TWeakObjectPtr<AAPosableCharacter> character;
+		int32 firstEntry;
+		int32 numEntries;
+		// false if an entry depends on the current pose of the character (look-at), which the key does not capture.
+		bool isShareable;
+	};
+
+	/**
+	* rebuild the flat entry array from the registered characters.
+	**/
+	void rebuildEntries();
+
+	/**
+	* evaluate the entries of one character and write them to its bone space transforms.
+	* @param slot: the entry range of the character.
+	* @param character: the character owning the layers.
+	* @param mesh: the posable mesh receiving the pose.
+	* @param currentTime: the world time in seconds.
+	* @return: true if at least one bone was written.
+	**/
+	bool evaluateSlot(const FCharacterSlot& slot, const AAPosableCharacter* character, UPoseableMeshComponent* mesh, float currentTime) const;
+
+	/**
+	* copy the bones driven by the playing entries of a slot from the shared group pose.
+	* @param slot: the entry range of the member.
+	* @param character: the member character.
+	* @param mesh: the posable mesh of the member.
+	* @param sharedRotations: the bone space rotations stored by the group leader, one per entry.
+	* @return: true if at least one bone was written.
+	**/
+	bool copySharedSlot(const FCharacterSlot& slot, const AAPosableCharacter* character, UPoseableMeshComponent* mesh, const TArray<FQuat>& sharedRotations) const;
+
+	TArray<TWeakObjectPtr<AAPosableCharacter>> registeredCharacters;
+	TArray<FCharacterSlot> characterSlots;
+	TArray<FResolvedEntry> entries;
+	bool entriesDirty = false;
+};